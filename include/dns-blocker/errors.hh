@@ -6,5 +6,6 @@
 #define DNSBERR_INVALID_RULE                -1
 #define DNSBERR_DUPLICATED_RULE             -2
 #define DNSBERR_INVALID_ARGUMENT            -3
+#define DNSBERR_MISSING_RULE                -4
 
 #endif // DNSB_ERRORS_HH
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "automaton.hh"
+#include "nodes.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace dnsblocker {
+
+Automaton::Automaton()
+{
+}
+
+uint32_t Automaton::size() const
+{
+    return (uint32_t) outputs_.size();
+}
+
+size_t Automaton::memory() const
+{
+    return sizeof(uint32_t) * transitions_.size() + outputs_.size() + sizeof(Automaton);
+}
+
+bool Automaton::empty() const
+{
+    return outputs_.empty();
+}
+
+/*
+ * Create a state whose transitions lead to the dead state. Returns the index
+ * of the state.
+ */
+uint32_t Automaton::add( uint8_t output )
+{
+    outputs_.push_back(output);
+    transitions_.resize(transitions_.size() + NODE_SLOTS, AUTOMATON_DEAD);
+    return (uint32_t) outputs_.size() - 1;
+}
+
+void Automaton::link( uint32_t from, int symbol, uint32_t to )
+{
+    transitions_[(size_t) from * NODE_SLOTS + (size_t) symbol] = to;
+}
+
+uint32_t Automaton::next( uint32_t state, int symbol ) const
+{
+    return transitions_[(size_t) state * NODE_SLOTS + (size_t) symbol];
+}
+
+uint8_t Automaton::output( uint32_t state ) const
+{
+    return outputs_[state];
+}
+
+/*
+ * Merge the equivalent states (Moore's algorithm): states start grouped by
+ * output and groups are split by the groups of their successors until
+ * nothing changes. States that can't lead to an output join the dead state,
+ * so matching stops as soon as the name can't match anymore, and states that
+ * can't be reached from the start state are dropped.
+ */
+void Automaton::minimize()
+{
+    size_t count = outputs_.size();
+    if (count <= AUTOMATON_START) return;
+
+    // initial groups by output
+    std::vector<uint32_t> groups(count), current(count);
+    uint32_t names[256];
+    uint32_t total = 0;
+    for (size_t i = 0; i < 256; ++i) names[i] = UINT32_MAX;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (names[outputs_[i]] == UINT32_MAX) names[outputs_[i]] = total++;
+        groups[i] = names[outputs_[i]];
+    }
+
+    // transitions that don't lead to the dead state, which are usually few
+    std::vector<uint32_t> edges;
+    std::vector<size_t> starts(count + 1);
+    for (size_t i = 0; i < count; ++i)
+    {
+        starts[i] = edges.size();
+        for (size_t j = 0; j < NODE_SLOTS; ++j)
+        {
+            if (transitions_[i * NODE_SLOTS + j] == AUTOMATON_DEAD) continue;
+            edges.push_back((uint32_t) j);
+            edges.push_back(transitions_[i * NODE_SLOTS + j]);
+        }
+    }
+    starts[count] = edges.size();
+
+    // signature of each state (its group and the groups of its successors) in a
+    // flat pool, and a hash table of states by signature
+    std::vector<uint32_t> pool;
+    std::vector<size_t> offsets(count + 1);
+    size_t mask = 1;
+    while (mask < count * 2) mask <<= 1;
+    std::vector<uint32_t> table(mask);
+    --mask;
+
+    while (true)
+    {
+        pool.clear();
+        std::fill(table.begin(), table.end(), 0);
+        uint32_t next = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            offsets[i] = pool.size();
+            pool.push_back(groups[i]);
+            for (size_t j = starts[i]; j < starts[i + 1]; j += 2)
+            {
+                uint32_t group = groups[edges[j + 1]];
+                if (group == groups[AUTOMATON_DEAD]) continue;
+                pool.push_back(edges[j]);
+                pool.push_back(group);
+            }
+            offsets[i + 1] = pool.size();
+
+            const uint32_t *signature = pool.data() + offsets[i];
+            size_t length = offsets[i + 1] - offsets[i];
+            uint32_t h = 2166136261U;
+            for (size_t j = 0; j < length; ++j) h = (h ^ signature[j]) * 16777619U;
+
+            // states with the same signature share the group of the first one
+            size_t slot = h & mask;
+            for (; table[slot] != 0; slot = (slot + 1) & mask)
+            {
+                size_t other = table[slot] - 1;
+                if (offsets[other + 1] - offsets[other] == length &&
+                    memcmp(pool.data() + offsets[other], signature, length * sizeof(uint32_t)) == 0)
+                    break;
+            }
+            if (table[slot] == 0)
+            {
+                table[slot] = (uint32_t) i + 1;
+                current[i] = next++;
+            }
+            else
+                current[i] = current[table[slot] - 1];
+        }
+        groups.swap(current);
+        if (next == total) break;
+        total = next;
+    }
+
+    // states reachable from the start state (the others are dropped)
+    std::vector<bool> reachable(count, false);
+    std::vector<uint32_t> queue(1, AUTOMATON_START);
+    reachable[AUTOMATON_START] = true;
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        for (size_t j = starts[queue[i]]; j < starts[queue[i] + 1]; j += 2)
+        {
+            uint32_t target = edges[j + 1];
+            if (reachable[target]) continue;
+            reachable[target] = true;
+            queue.push_back(target);
+        }
+    }
+
+    // number the groups so the dead state and the start state keep their indices
+    std::vector<uint32_t> index(total, UINT32_MAX);
+    std::vector<uint32_t> first; // a state of each group, in the new order
+    index[groups[AUTOMATON_DEAD]] = AUTOMATON_DEAD;
+    first.push_back(AUTOMATON_DEAD);
+    if (groups[AUTOMATON_START] == groups[AUTOMATON_DEAD])
+    {
+        // nothing can be matched
+        clear();
+        return;
+    }
+    index[groups[AUTOMATON_START]] = AUTOMATON_START;
+    first.push_back(AUTOMATON_START);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!reachable[i] || index[groups[i]] != UINT32_MAX) continue;
+        index[groups[i]] = (uint32_t) first.size();
+        first.push_back((uint32_t) i);
+    }
+
+    std::vector<uint32_t> transitions(first.size() * NODE_SLOTS);
+    std::vector<uint8_t> outputs(first.size());
+    for (size_t i = 0; i < first.size(); ++i)
+    {
+        outputs[i] = outputs_[first[i]];
+        for (size_t j = 0; j < NODE_SLOTS; ++j)
+            transitions[i * NODE_SLOTS + j] = index[groups[transitions_[first[i] * NODE_SLOTS + j]]];
+    }
+    transitions_.swap(transitions);
+    outputs_.swap(outputs);
+}
+
+uint8_t Automaton::match( const std::string &host ) const
+{
+    if (outputs_.empty() || host.empty() || host.length() > NODE_MAX_HOST_LENGTH) return 0;
+
+    uint32_t state = AUTOMATON_START;
+    for (size_t i = host.length(); i > 0 && state != AUTOMATON_DEAD; --i)
+    {
+        int symbol = charToIndex(host[i - 1]);
+        if (symbol < 0) return 0;
+        state = transitions_[(size_t) state * NODE_SLOTS + (size_t) symbol];
+    }
+    return outputs_[state];
+}
+
+// same as above for a host name in DNS wire format
+uint8_t Automaton::match( const uint8_t *qname, size_t size ) const
+{
+    if (outputs_.empty()) return 0;
+
+    WireName name;
+    if (!name.read(qname, size)) return 0;
+
+    uint32_t state = AUTOMATON_START;
+    for (char c = name.next(); c != 0 && state != AUTOMATON_DEAD; c = name.next())
+        state = transitions_[(size_t) state * NODE_SLOTS + (size_t) charToIndex(c)];
+    return outputs_[state];
+}
+
+void Automaton::clear()
+{
+    transitions_.clear();
+    transitions_.shrink_to_fit();
+    outputs_.clear();
+    outputs_.shrink_to_fit();
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef DNSB_AUTOMATON_HH
+#define DNSB_AUTOMATON_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dnsblocker {
+
+
+#define AUTOMATON_DEAD    0   // state that never leads to an output
+#define AUTOMATON_START   1
+
+
+/*
+ * Deterministic automaton over the 38 symbols of 'charToIndex'. Host names are
+ * fed in the order used by the trees (last character first, lowercased), one
+ * table lookup per character, and the result is the output (a bitmask of
+ * verdicts) of the state where the name ends. Builders create the dead state
+ * and the start state first, then the rest of the states and transitions, and
+ * finally call 'minimize'.
+ */
+class Automaton
+{
+    public:
+        Automaton();
+        uint32_t size() const;
+        size_t memory() const;
+        bool empty() const;
+        uint32_t add( uint8_t output );
+        void link( uint32_t from, int symbol, uint32_t to );
+        uint32_t next( uint32_t state, int symbol ) const;
+        uint8_t output( uint32_t state ) const;
+        void minimize();
+        uint8_t match( const std::string &host ) const;
+        uint8_t match( const uint8_t *qname, size_t size ) const;
+        void clear();
+
+    private:
+        std::vector<uint32_t> transitions_; // NODE_SLOTS entries per state
+        std::vector<uint8_t> outputs_;
+};
+
+}
+
+#endif // DNSB_AUTOMATON_HH
@@ -0,0 +1,316 @@
+#include "nodes.hh"
+#include "radix.hh"
+#include "suffix.hh"
+#include "scanner.hh"
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+
+int main_usage()
+{
+    std::cerr << "Usage: benchmark <rules> [ <queries> ]" << std::endl;
+    std::cerr << "       benchmark -p <rules>" << std::endl;
+    return 1;
+}
+
+
+static void loadLines( const std::string &fileName, std::vector<std::string> &values )
+{
+    std::ifstream input(fileName.c_str());
+    if (!input.good()) return;
+    std::string line;
+
+    while (!input.eof())
+    {
+        std::getline(input, line);
+        size_t pos = line.find('#');
+        if (pos != std::string::npos) line = line.substr(0, pos);
+        if (!line.empty()) values.push_back(line);
+    }
+}
+
+
+static double elapsed( const bench_clock::time_point &start )
+{
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start).count();
+}
+
+
+/*
+ * Build the queries from the rules themselves (positive lookups) and from
+ * the same names prefixed with an unknown label (mostly negative lookups).
+ */
+static void makeQueries( const std::vector<std::string> &rules, std::vector<std::string> &queries )
+{
+    for (auto it = rules.begin(); it != rules.end(); ++it)
+    {
+        size_t start = it->find_first_not_of(" \t*.");
+        if (start == std::string::npos) continue;
+        size_t end = it->find_first_of(" \t", start);
+        std::string host = it->substr(start, end - start);
+        queries.push_back(host);
+        queries.push_back("zz9-" + host.substr(host.find('.') + 1));
+    }
+}
+
+
+template<typename R>
+static void bench( const char *name, const std::vector<std::string> &rules,
+    const std::vector<std::string> &queries )
+{
+    R tree;
+
+    auto start = bench_clock::now();
+    for (auto it = rules.begin(); it != rules.end(); ++it) tree.add(*it, 0);
+    double load = elapsed(start);
+
+    size_t found = 0;
+    const int ROUNDS = 5;
+    start = bench_clock::now();
+    for (int i = 0; i < ROUNDS; ++i)
+        for (auto it = queries.begin(); it != queries.end(); ++it)
+            if (tree.match(*it) != nullptr) ++found;
+    double lookup = elapsed(start) / (double) (queries.size() * ROUNDS);
+
+    fprintf(stdout, "%-8s  %10u nodes  %10.3f MiB  load %8.1f ms  match %7.1f ns  (%zu hits)\n",
+        name,
+        tree.size(),
+        (double) tree.memory() / (1024.0 * 1024.0),
+        load / 1000000.0,
+        lookup,
+        found / ROUNDS);
+}
+
+
+/*
+ * Encode a host name in DNS wire format, like the QNAME of a query.
+ */
+static std::vector<uint8_t> makeWireName( const std::string &host )
+{
+    std::vector<uint8_t> output;
+    size_t start = 0;
+    while (start <= host.length())
+    {
+        size_t end = host.find('.', start);
+        if (end == std::string::npos) end = host.length();
+        output.push_back((uint8_t) (end - start));
+        output.insert(output.end(), host.begin() + (long) start, host.begin() + (long) end);
+        start = end + 1;
+    }
+    output.push_back(0);
+    return output;
+}
+
+
+/*
+ * Same lookups as 'bench', but matching the wire-format names.
+ */
+template<typename R>
+static void benchWire( const char *name, const std::vector<std::string> &rules,
+    const std::vector<std::string> &queries )
+{
+    R tree;
+    for (auto it = rules.begin(); it != rules.end(); ++it) tree.add(*it, 0);
+
+    std::vector< std::vector<uint8_t> > names;
+    for (auto it = queries.begin(); it != queries.end(); ++it) names.push_back(makeWireName(*it));
+
+    size_t found = 0;
+    const int ROUNDS = 5;
+    auto start = bench_clock::now();
+    for (int i = 0; i < ROUNDS; ++i)
+        for (auto it = names.begin(); it != names.end(); ++it)
+            if (tree.match(it->data(), it->size()) != nullptr) ++found;
+    double lookup = elapsed(start) / (double) (names.size() * ROUNDS);
+
+    fprintf(stdout, "%-8s  %10u nodes  %10.3f MiB  %19s  match %7.1f ns  (%zu hits)\n",
+        name,
+        tree.size(),
+        (double) tree.memory() / (1024.0 * 1024.0),
+        "",
+        lookup,
+        found / ROUNDS);
+}
+
+
+/*
+ * Validate, lowercase and reverse a host name one character at a time, like
+ * 'prepareHostname' used to do.
+ */
+static bool normalizeScalar( const char *input, size_t length, char *output )
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        char c = input[i];
+        if (charToIndex(c) < 0) return false;
+        if (c >= 'A' && c <= 'Z') c = (char) (c + 32);
+        output[length - i - 1] = c;
+    }
+    return true;
+}
+
+
+/*
+ * Compare the scalar loop with 'normalizeHost' for the queries in each range
+ * of lengths.
+ */
+static void benchNormalize( const std::vector<std::string> &queries )
+{
+    const size_t RANGES[][2] = { { 1, 19 }, { 20, 39 }, { 40, 60 }, { 61, NODE_MAX_HOST_LENGTH } };
+    const int ROUNDS = 20;
+    char output[NODE_MAX_HOST_LENGTH];
+
+    for (size_t r = 0; r < sizeof(RANGES) / sizeof(RANGES[0]); ++r)
+    {
+        std::vector<const std::string*> names;
+        for (auto it = queries.begin(); it != queries.end(); ++it)
+            if (it->length() >= RANGES[r][0] && it->length() <= RANGES[r][1]) names.push_back(&*it);
+        if (names.empty()) continue;
+
+        double times[2];
+        size_t valid[2] = { 0, 0 };
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            auto start = bench_clock::now();
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                for (auto it = names.begin(); it != names.end(); ++it)
+                {
+                    const std::string &name = **it;
+                    bool result = (mode == 0) ? normalizeScalar(name.c_str(), name.length(), output) :
+                        normalizeHost(name.c_str(), name.length(), output, true);
+                    if (result) valid[mode] += (uint8_t) output[0];
+                }
+            }
+            times[mode] = elapsed(start) / (double) (names.size() * ROUNDS);
+        }
+
+        fprintf(stdout, "normalize %3zu-%-3zu  %10zu names  scalar %6.1f ns  kernel %6.1f ns  %s\n",
+            RANGES[r][0],
+            RANGES[r][1],
+            names.size(),
+            times[0],
+            times[1],
+            (valid[0] == valid[1]) ? "" : "(mismatch)");
+    }
+}
+
+
+/*
+ * Read the rules with 'std::getline', like 'loadRules' used to do.
+ */
+template<typename R>
+static size_t parseStream( const std::string &fileName, R *tree )
+{
+    std::ifstream input(fileName.c_str());
+    std::string line;
+    size_t count = 0;
+
+    while (!input.eof())
+    {
+        std::getline(input, line);
+        if (line.empty()) continue;
+        size_t pos = line.find('#');
+        if (pos != std::string::npos) line = line.substr(0, pos);
+        if (tree != nullptr)
+            tree->add(line, 0, &line);
+        else
+        {
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos) continue;
+            size_t end = line.find_first_of(" \t", start);
+            line = line.substr(start, end - start);
+        }
+        if (!line.empty()) ++count;
+    }
+    return count;
+}
+
+
+/*
+ * Read the rules with the scanner, from the mapped file.
+ */
+template<typename R>
+static size_t parseMapped( const std::string &fileName, R *tree )
+{
+    size_t count = 0;
+    scanRuleFile(fileName, [tree, &count]( const char *rule, size_t length, uint32_t )
+    {
+        if (tree != nullptr) tree->add(rule, length, 0);
+        ++count;
+    });
+    return count;
+}
+
+
+static void benchParser( const std::string &fileName )
+{
+    std::ifstream input(fileName.c_str(), std::ios::binary | std::ios::ate);
+    double bytes = (double) input.tellg();
+    input.close();
+    if (bytes <= 0) return;
+
+    const int ROUNDS = 5;
+    const char *NAMES[] = { "getline", "mapped" };
+    for (int insert = 0; insert < 2; ++insert)
+    {
+        for (int mode = 0; mode < 2; ++mode)
+        {
+            double total = 0;
+            size_t count = 0;
+            for (int i = 0; i < ROUNDS; ++i)
+            {
+                RadixTree<uint8_t> tree;
+                RadixTree<uint8_t> *target = (insert != 0) ? &tree : nullptr;
+                auto start = bench_clock::now();
+                count = (mode == 0) ? parseStream(fileName, target) : parseMapped(fileName, target);
+                total += elapsed(start);
+            }
+            double seconds = total / (ROUNDS * 1000000000.0);
+            fprintf(stdout, "%-8s  %-8s  %10zu rules  %8.1f ms  %8.1f MB/s\n",
+                NAMES[mode],
+                (insert != 0) ? "radix" : "parse",
+                count,
+                seconds * 1000.0,
+                bytes / (seconds * 1000000.0));
+        }
+    }
+}
+
+
+int main( int argc, char **argv )
+{
+    if (argc < 2 || argc > 3) return main_usage();
+
+    if (std::string(argv[1]) == "-p")
+    {
+        if (argc != 3) return main_usage();
+        benchParser(argv[2]);
+        return 0;
+    }
+
+    std::vector<std::string> rules;
+    std::vector<std::string> queries;
+    loadLines(argv[1], rules);
+    if (argc == 3)
+        loadLines(argv[2], queries);
+    else
+        makeQueries(rules, queries);
+
+    fprintf(stdout, "%zu rules, %zu queries\n\n", rules.size(), queries.size());
+    if (rules.empty() || queries.empty()) return 1;
+
+    bench< Tree<uint8_t> >("dense", rules, queries);
+    bench< Tree<uint8_t, SparseNode<uint8_t> > >("sparse", rules, queries);
+    bench< RadixTree<uint8_t> >("radix", rules, queries);
+    bench< SuffixTable<uint8_t> >("hash", rules, queries);
+    benchWire< RadixTree<uint8_t> >("radix/w", rules, queries);
+    benchWire< SuffixTable<uint8_t> >("hash/w", rules, queries);
+    fprintf(stdout, "\n");
+    benchNormalize(queries);
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "buffer.hh"
+#include "nodes.hh"
 
 namespace dnsblocker {
 
@@ -73,13 +74,12 @@ uint8_t *buffer::readLabels( uint8_t *ptr, std::string &qname )
             return ptr += 2;
         }
 
-        int length = (int) (*ptr++) & 0x3F;
-        for (int i = 0; i < length; ++i)
-        {
-            char c = (char) *ptr++;
-            if (c >= 'A' && c <= 'Z') c = (char)(c + 32);
-            qname.push_back(c);
-        }
+        // lowercase the label (invalid characters are kept and rejected by the rules)
+        size_t length = (size_t) (*ptr++) & 0x3F;
+        size_t offset = qname.length();
+        qname.resize(offset + length);
+        normalizeHost((const char*) ptr, length, &qname[offset], false);
+        ptr += length;
 
         if (*ptr != 0) qname.push_back('.');
     }
@@ -238,6 +238,168 @@ template<> struct json< ::Cache_type>
 PG_ENTITY(Cache, ::Cache_type,protogen_2_0_0::json< ::Cache_type>)
 PG_ENTITY_SERIALIZER( ::Cache, ::Cache_type,protogen_2_0_0::json< ::Cache_type>)
 
+//
+// Category
+//
+    struct Category_type
+    {
+        std::string name;
+        std::vector<std::string> lists;
+        protogen_2_0_0::field<bool> disabled;
+    };
+namespace protogen_2_0_0 {
+template<> struct json< ::Category_type>
+{
+    static int read( json_context &ctx,  ::Category_type &value ) { return read_object(ctx, value); }
+    static int read_field( json_context &ctx, const std::string &name,  ::Category_type &value ) \
+    {
+        PG_DIF_EX(0,name,"name")
+        PG_DIF_EX(1,lists,"lists")
+        PG_DIF_EX(2,disabled,"disabled")
+        return PGR_NIL;
+    }
+    static void write( json_context &ctx, const  ::Category_type &value )
+    {
+        bool first = true;
+        (*ctx.os) << '{';
+        PG_SIF_EX(name,"name")
+        PG_SIF_EX(lists,"lists")
+        PG_SIF_EX(disabled,"disabled")
+        (*ctx.os) << '}';
+    }
+    static bool empty( const  ::Category_type &value )
+    {
+        if (!json<decltype(value.name)>::empty(value.name)) return false;
+        if (!json<decltype(value.lists)>::empty(value.lists)) return false;
+        if (!json<decltype(value.disabled)>::empty(value.disabled)) return false;
+        return true;
+    }
+    static void clear(  ::Category_type &value )
+    {
+        json<decltype(value.name)>::clear(value.name);
+        json<decltype(value.lists)>::clear(value.lists);
+        json<decltype(value.disabled)>::clear(value.disabled);
+    }
+    static bool equal( const  ::Category_type &a, const  ::Category_type &b )
+    {
+        if (!json<decltype(a.name)>::equal(a.name, b.name)) return false;
+        if (!json<decltype(a.lists)>::equal(a.lists, b.lists)) return false;
+        if (!json<decltype(a.disabled)>::equal(a.disabled, b.disabled)) return false;
+        return true;
+    }
+    static void swap(  ::Category_type &a,  ::Category_type &b )
+    {
+        json<decltype(a.name)>::swap(a.name, b.name);
+        json<decltype(a.lists)>::swap(a.lists, b.lists);
+        json<decltype(a.disabled)>::swap(a.disabled, b.disabled);
+    }
+    static bool is_missing( json_context &ctx )
+    {
+        std::string name;
+        if (!(ctx.mask & 1)) { name = "name"; } else
+        if (!(ctx.mask & 2)) { name = "lists"; } else
+        if (!(ctx.mask & 4)) { name = "disabled"; } else
+        return false;
+        ctx.tok->error(PGERR_MISSING_FIELD, std::string("Missing field '") + name + "'");
+        return true;
+    }
+};}
+PG_ENTITY(Category, ::Category_type,protogen_2_0_0::json< ::Category_type>)
+PG_ENTITY_SERIALIZER( ::Category, ::Category_type,protogen_2_0_0::json< ::Category_type>)
+
+//
+// Policy
+//
+    struct Policy_type
+    {
+        std::string name;
+        std::vector<std::string> clients;
+        std::vector<std::string> categories;
+        protogen_2_0_0::field<bool> disable_filtering;
+        protogen_2_0_0::field<bool> disable_heuristics;
+        std::string upstream;
+    };
+namespace protogen_2_0_0 {
+template<> struct json< ::Policy_type>
+{
+    static int read( json_context &ctx,  ::Policy_type &value ) { return read_object(ctx, value); }
+    static int read_field( json_context &ctx, const std::string &name,  ::Policy_type &value ) \
+    {
+        PG_DIF_EX(0,name,"name")
+        PG_DIF_EX(1,clients,"clients")
+        PG_DIF_EX(2,categories,"categories")
+        PG_DIF_EX(3,disable_filtering,"disable_filtering")
+        PG_DIF_EX(4,disable_heuristics,"disable_heuristics")
+        PG_DIF_EX(5,upstream,"upstream")
+        return PGR_NIL;
+    }
+    static void write( json_context &ctx, const  ::Policy_type &value )
+    {
+        bool first = true;
+        (*ctx.os) << '{';
+        PG_SIF_EX(name,"name")
+        PG_SIF_EX(clients,"clients")
+        PG_SIF_EX(categories,"categories")
+        PG_SIF_EX(disable_filtering,"disable_filtering")
+        PG_SIF_EX(disable_heuristics,"disable_heuristics")
+        PG_SIF_EX(upstream,"upstream")
+        (*ctx.os) << '}';
+    }
+    static bool empty( const  ::Policy_type &value )
+    {
+        if (!json<decltype(value.name)>::empty(value.name)) return false;
+        if (!json<decltype(value.clients)>::empty(value.clients)) return false;
+        if (!json<decltype(value.categories)>::empty(value.categories)) return false;
+        if (!json<decltype(value.disable_filtering)>::empty(value.disable_filtering)) return false;
+        if (!json<decltype(value.disable_heuristics)>::empty(value.disable_heuristics)) return false;
+        if (!json<decltype(value.upstream)>::empty(value.upstream)) return false;
+        return true;
+    }
+    static void clear(  ::Policy_type &value )
+    {
+        json<decltype(value.name)>::clear(value.name);
+        json<decltype(value.clients)>::clear(value.clients);
+        json<decltype(value.categories)>::clear(value.categories);
+        json<decltype(value.disable_filtering)>::clear(value.disable_filtering);
+        json<decltype(value.disable_heuristics)>::clear(value.disable_heuristics);
+        json<decltype(value.upstream)>::clear(value.upstream);
+    }
+    static bool equal( const  ::Policy_type &a, const  ::Policy_type &b )
+    {
+        if (!json<decltype(a.name)>::equal(a.name, b.name)) return false;
+        if (!json<decltype(a.clients)>::equal(a.clients, b.clients)) return false;
+        if (!json<decltype(a.categories)>::equal(a.categories, b.categories)) return false;
+        if (!json<decltype(a.disable_filtering)>::equal(a.disable_filtering, b.disable_filtering)) return false;
+        if (!json<decltype(a.disable_heuristics)>::equal(a.disable_heuristics, b.disable_heuristics)) return false;
+        if (!json<decltype(a.upstream)>::equal(a.upstream, b.upstream)) return false;
+        return true;
+    }
+    static void swap(  ::Policy_type &a,  ::Policy_type &b )
+    {
+        json<decltype(a.name)>::swap(a.name, b.name);
+        json<decltype(a.clients)>::swap(a.clients, b.clients);
+        json<decltype(a.categories)>::swap(a.categories, b.categories);
+        json<decltype(a.disable_filtering)>::swap(a.disable_filtering, b.disable_filtering);
+        json<decltype(a.disable_heuristics)>::swap(a.disable_heuristics, b.disable_heuristics);
+        json<decltype(a.upstream)>::swap(a.upstream, b.upstream);
+    }
+    static bool is_missing( json_context &ctx )
+    {
+        std::string name;
+        if (!(ctx.mask & 1)) { name = "name"; } else
+        if (!(ctx.mask & 2)) { name = "clients"; } else
+        if (!(ctx.mask & 4)) { name = "categories"; } else
+        if (!(ctx.mask & 8)) { name = "disable_filtering"; } else
+        if (!(ctx.mask & 16)) { name = "disable_heuristics"; } else
+        if (!(ctx.mask & 32)) { name = "upstream"; } else
+        return false;
+        ctx.tok->error(PGERR_MISSING_FIELD, std::string("Missing field '") + name + "'");
+        return true;
+    }
+};}
+PG_ENTITY(Policy, ::Policy_type,protogen_2_0_0::json< ::Policy_type>)
+PG_ENTITY_SERIALIZER( ::Policy, ::Policy_type,protogen_2_0_0::json< ::Policy_type>)
+
 //
 // Configuration
 //
@@ -253,6 +415,13 @@ PG_ENTITY_SERIALIZER( ::Cache, ::Cache_type,protogen_2_0_0::json< ::Cache_type>)
         protogen_2_0_0::field<int32_t> threads;
          ::Cache cache;
         protogen_2_0_0::field<bool> use_heuristics;
+        protogen_2_0_0::field<bool> use_prefilter;
+        protogen_2_0_0::field<bool> prune_rules;
+        std::vector<std::string> keywords;
+        std::string unused_path_;
+        std::vector< ::Category> categories;
+        std::vector< ::Policy> policies;
+        std::string heuristics_model;
     };
 namespace protogen_2_0_0 {
 template<> struct json< ::Configuration_type>
@@ -268,6 +437,12 @@ template<> struct json< ::Configuration_type>
         PG_DIF_EX(7,threads,"threads")
         PG_DIF_EX(8,cache,"cache")
         PG_DIF_EX(9,use_heuristics,"use_heuristics")
+        PG_DIF_EX(10,use_prefilter,"use_prefilter")
+        PG_DIF_EX(11,prune_rules,"prune_rules")
+        PG_DIF_EX(12,keywords,"keywords")
+        PG_DIF_EX(14,categories,"categories")
+        PG_DIF_EX(15,policies,"policies")
+        PG_DIF_EX(16,heuristics_model,"heuristics_model")
         return PGR_NIL;
     }
     static void write( json_context &ctx, const  ::Configuration_type &value )
@@ -282,6 +457,12 @@ template<> struct json< ::Configuration_type>
         PG_SIF_EX(threads,"threads")
         PG_SIF_EX(cache,"cache")
         PG_SIF_EX(use_heuristics,"use_heuristics")
+        PG_SIF_EX(use_prefilter,"use_prefilter")
+        PG_SIF_EX(prune_rules,"prune_rules")
+        PG_SIF_EX(keywords,"keywords")
+        PG_SIF_EX(categories,"categories")
+        PG_SIF_EX(policies,"policies")
+        PG_SIF_EX(heuristics_model,"heuristics_model")
         (*ctx.os) << '}';
     }
     static bool empty( const  ::Configuration_type &value )
@@ -296,6 +477,13 @@ template<> struct json< ::Configuration_type>
         if (!json<decltype(value.threads)>::empty(value.threads)) return false;
         if (!json<decltype(value.cache)>::empty(value.cache)) return false;
         if (!json<decltype(value.use_heuristics)>::empty(value.use_heuristics)) return false;
+        if (!json<decltype(value.use_prefilter)>::empty(value.use_prefilter)) return false;
+        if (!json<decltype(value.prune_rules)>::empty(value.prune_rules)) return false;
+        if (!json<decltype(value.keywords)>::empty(value.keywords)) return false;
+        if (!json<decltype(value.unused_path_)>::empty(value.unused_path_)) return false;
+        if (!json<decltype(value.categories)>::empty(value.categories)) return false;
+        if (!json<decltype(value.policies)>::empty(value.policies)) return false;
+        if (!json<decltype(value.heuristics_model)>::empty(value.heuristics_model)) return false;
         return true;
     }
     static void clear(  ::Configuration_type &value )
@@ -310,6 +498,13 @@ template<> struct json< ::Configuration_type>
         json<decltype(value.threads)>::clear(value.threads);
         json<decltype(value.cache)>::clear(value.cache);
         json<decltype(value.use_heuristics)>::clear(value.use_heuristics);
+        json<decltype(value.use_prefilter)>::clear(value.use_prefilter);
+        json<decltype(value.prune_rules)>::clear(value.prune_rules);
+        json<decltype(value.keywords)>::clear(value.keywords);
+        json<decltype(value.unused_path_)>::clear(value.unused_path_);
+        json<decltype(value.categories)>::clear(value.categories);
+        json<decltype(value.policies)>::clear(value.policies);
+        json<decltype(value.heuristics_model)>::clear(value.heuristics_model);
     }
     static bool equal( const  ::Configuration_type &a, const  ::Configuration_type &b )
     {
@@ -323,6 +518,13 @@ template<> struct json< ::Configuration_type>
         if (!json<decltype(a.threads)>::equal(a.threads, b.threads)) return false;
         if (!json<decltype(a.cache)>::equal(a.cache, b.cache)) return false;
         if (!json<decltype(a.use_heuristics)>::equal(a.use_heuristics, b.use_heuristics)) return false;
+        if (!json<decltype(a.use_prefilter)>::equal(a.use_prefilter, b.use_prefilter)) return false;
+        if (!json<decltype(a.prune_rules)>::equal(a.prune_rules, b.prune_rules)) return false;
+        if (!json<decltype(a.keywords)>::equal(a.keywords, b.keywords)) return false;
+        if (!json<decltype(a.unused_path_)>::equal(a.unused_path_, b.unused_path_)) return false;
+        if (!json<decltype(a.categories)>::equal(a.categories, b.categories)) return false;
+        if (!json<decltype(a.policies)>::equal(a.policies, b.policies)) return false;
+        if (!json<decltype(a.heuristics_model)>::equal(a.heuristics_model, b.heuristics_model)) return false;
         return true;
     }
     static void swap(  ::Configuration_type &a,  ::Configuration_type &b )
@@ -337,6 +539,13 @@ template<> struct json< ::Configuration_type>
         json<decltype(a.threads)>::swap(a.threads, b.threads);
         json<decltype(a.cache)>::swap(a.cache, b.cache);
         json<decltype(a.use_heuristics)>::swap(a.use_heuristics, b.use_heuristics);
+        json<decltype(a.use_prefilter)>::swap(a.use_prefilter, b.use_prefilter);
+        json<decltype(a.prune_rules)>::swap(a.prune_rules, b.prune_rules);
+        json<decltype(a.keywords)>::swap(a.keywords, b.keywords);
+        json<decltype(a.unused_path_)>::swap(a.unused_path_, b.unused_path_);
+        json<decltype(a.categories)>::swap(a.categories, b.categories);
+        json<decltype(a.policies)>::swap(a.policies, b.policies);
+        json<decltype(a.heuristics_model)>::swap(a.heuristics_model, b.heuristics_model);
     }
     static bool is_missing( json_context &ctx )
     {
@@ -349,6 +558,12 @@ template<> struct json< ::Configuration_type>
         if (!(ctx.mask & 128)) { name = "threads"; } else
         if (!(ctx.mask & 256)) { name = "cache"; } else
         if (!(ctx.mask & 512)) { name = "use_heuristics"; } else
+        if (!(ctx.mask & 1024)) { name = "use_prefilter"; } else
+        if (!(ctx.mask & 2048)) { name = "prune_rules"; } else
+        if (!(ctx.mask & 4096)) { name = "keywords"; } else
+        if (!(ctx.mask & 16384)) { name = "categories"; } else
+        if (!(ctx.mask & 32768)) { name = "policies"; } else
+        if (!(ctx.mask & 65536)) { name = "heuristics_model"; } else
         return false;
         ctx.tok->error(PGERR_MISSING_FIELD, std::string("Missing field '") + name + "'");
         return true;
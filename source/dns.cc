@@ -1,5 +1,6 @@
 #include "dns.hh"
 #include <stdio.h>
+#include <cstring>
 #include <string>
 #include <string>
 #include "log.hh"
@@ -7,6 +8,7 @@
 #include <chrono>
 #include <unordered_map>
 #include <atomic>
+#include <algorithm>
 
 #ifndef __WINDOWS__
 #include <poll.h>
@@ -164,6 +166,213 @@ void dns_message_t::print() const
 }
 
 
+dns_message_view::dns_message_view() : data(nullptr), size(0), id(0), flags(0), qdcount(0), qtype(0),
+    qclass(0), qnameOffset(DNS_HEADER_SIZE), qnameSize(0), length(0), labels(0), udpSize(DNS_UDP_SIZE),
+    edns(false)
+{
+}
+
+
+/*
+ * Validate the header and the first question of a query. Responses, queries
+ * without questions and compressed or truncated names are rejected. The UDP
+ * payload size is taken from the OPT record (RFC-6891), if it follows the
+ * question.
+ */
+bool dns_message_view::read( const uint8_t *data, size_t size )
+{
+    this->data = data;
+    this->size = size;
+    if (data == nullptr || size < DNS_HEADER_SIZE) return false;
+
+    id = (uint16_t) ((data[0] << 8) | data[1]);
+    flags = (uint16_t) ((data[2] << 8) | data[3]);
+    qdcount = (uint16_t) ((data[4] << 8) | data[5]);
+    if ((flags & DNS_FLAG_QR) || qdcount == 0) return false;
+
+    // the question has no compression pointers since nothing precedes it
+    size_t i = qnameOffset = DNS_HEADER_SIZE;
+    length = labels = 0;
+    while (i < size && data[i] != 0)
+    {
+        if ((data[i] & 0xC0) != 0) return false;
+        ++labels;
+        length += data[i] + 1U;
+        i += data[i] + 1U;
+        if (i - qnameOffset >= DNS_NAME_SIZE) return false;
+    }
+    if (i >= size) return false;
+    if (length > 0) --length;
+    qnameSize = i + 1 - qnameOffset;
+
+    if (questionEnd() > size) return false;
+    qtype = (uint16_t) ((data[i + 1] << 8) | data[i + 2]);
+    qclass = (uint16_t) ((data[i + 3] << 8) | data[i + 4]);
+
+    udpSize = DNS_UDP_SIZE;
+    const uint8_t *opt = data + questionEnd();
+    edns = qdcount == 1 && memcmp(data + 6, "\0\0\0\0", 4) == 0 && (data[10] | data[11]) != 0 &&
+        questionEnd() + 11 <= size && opt[0] == 0 && ((opt[1] << 8) | opt[2]) == DNS_TYPE_OPT;
+    if (edns)
+    {
+        uint16_t value = (uint16_t) ((opt[3] << 8) | opt[4]);
+        if (value > DNS_UDP_SIZE) udpSize = value;
+    }
+    return true;
+}
+
+
+/*
+ * Write the QNAME in text form, lowercased like 'buffer::readQName' does, and
+ * return its length. 'output' must have room for DNS_NAME_SIZE characters.
+ */
+size_t dns_message_view::name( char *output ) const
+{
+    const uint8_t *ptr = qname();
+    char *current = output;
+    while (*ptr != 0)
+    {
+        if (current != output) *current++ = '.';
+        for (size_t i = 1; i <= *ptr; ++i)
+        {
+            char c = (char) ptr[i];
+            *current++ = (c >= 'A' && c <= 'Z') ? (char) (c + 32) : c;
+        }
+        ptr += *ptr + 1;
+    }
+    *current = 0;
+    return (size_t) (current - output);
+}
+
+
+/*
+ * Answer records of each type with the owner name compressed as a pointer to
+ * the QNAME of the question (RFC-1035 4.1.4), built once. The RDATA is the
+ * address of blocked domains.
+ */
+struct dns_answer_template
+{
+    uint8_t data[DNS_ANSWER_SIZE];
+    size_t size;
+
+    dns_answer_template( uint16_t type )
+    {
+        static const uint16_t IPV6_ADDRESS[] = DNS_BLOCKED_IPV6_ADDRESS;
+        buffer bio(DNS_ANSWER_SIZE);
+        bio.writeU16(DNS_QNAME_POINTER);
+        bio.writeU16(type);
+        bio.writeU16(1); // IN
+        bio.writeU32(DNS_ANSWER_TTL);
+        if (type == DNS_TYPE_AAAA)
+        {
+            bio.writeU16(16);
+            for (int i = 0; i < 8; ++i) bio.writeU16(IPV6_ADDRESS[i]);
+        }
+        else
+        {
+            bio.writeU16(4);
+            bio.writeU32(DNS_BLOCKED_IPV4_ADDRESS);
+        }
+        size = bio.cursor();
+        memcpy(data, bio.data(), size);
+    }
+};
+
+static const dns_answer_template DNS_ANSWER_A(DNS_TYPE_A);
+static const dns_answer_template DNS_ANSWER_AAAA(DNS_TYPE_AAAA);
+
+
+// copy the header and the question of the request to a response with the given flags
+static size_t dns_copyQuestion( const dns_message_view &request, uint16_t flags, uint16_t ancount,
+    uint8_t *output )
+{
+    size_t size = request.questionEnd();
+    memcpy(output, request.data, size);
+    output[2] = (uint8_t) (flags >> 8);
+    output[3] = (uint8_t) flags;
+    output[4] = 0;
+    output[5] = 1; // QDCOUNT
+    output[6] = (uint8_t) (ancount >> 8);
+    output[7] = (uint8_t) ancount;
+    memset(output + 8, 0, 4); // NSCOUNT and ARCOUNT
+    return size;
+}
+
+
+/*
+ * Build in place a response to the request with the given RCODE and no
+ * answers. 'output' must have room for DNS_RESPONSE_SIZE bytes. Returns the
+ * size of the response.
+ */
+size_t dns_error( const dns_message_view &request, int rcode, uint8_t *output )
+{
+    return dns_copyQuestion(request, (uint16_t) (DNS_FLAG_QR | (rcode & 15)), 0, output);
+}
+
+
+/*
+ * Build in place a response to the request with one answer: the given address,
+ * or the blocked address if 'address' is null. 'output' must have room for
+ * DNS_RESPONSE_SIZE bytes. Returns the size of the response.
+ */
+size_t dns_answer( const dns_message_view &request, const Address *address, uint8_t *output )
+{
+    uint16_t flags = DNS_FLAG_QR;
+    if (request.flags & DNS_FLAG_RD) flags |= DNS_FLAG_RD | DNS_FLAG_RA;
+    size_t size = dns_copyQuestion(request, flags, 1, output);
+
+    int type = (address != nullptr) ? address->type : request.qtype;
+    const dns_answer_template &answer = (type == ADDR_TYPE_AAAA) ? DNS_ANSWER_AAAA : DNS_ANSWER_A;
+    uint8_t *record = output + size;
+    memcpy(record, answer.data, answer.size);
+    // same class of the question
+    record[4] = request.data[request.questionEnd() - 2];
+    record[5] = request.data[request.questionEnd() - 1];
+    if (address != nullptr)
+    {
+        uint8_t *rdata = record + answer.size - ((type == ADDR_TYPE_AAAA) ? 16 : 4);
+        if (type == ADDR_TYPE_AAAA)
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                rdata[i * 2] = (uint8_t) (address->ipv6[i] >> 8);
+                rdata[i * 2 + 1] = (uint8_t) address->ipv6[i];
+            }
+        }
+        else
+        {
+            rdata[0] = (uint8_t) DNS_IP_O1(address->ipv4);
+            rdata[1] = (uint8_t) DNS_IP_O2(address->ipv4);
+            rdata[2] = (uint8_t) DNS_IP_O3(address->ipv4);
+            rdata[3] = (uint8_t) DNS_IP_O4(address->ipv4);
+        }
+    }
+    return size + answer.size;
+}
+
+
+// mnemonic of a record type (RFC-1035 3.2.2 and later)
+std::string dns_typeName( uint16_t type )
+{
+    switch (type)
+    {
+        case DNS_TYPE_A:     return "A";
+        case DNS_TYPE_NS:    return "NS";
+        case DNS_TYPE_CNAME: return "CNAME";
+        case DNS_TYPE_SOA:   return "SOA";
+        case DNS_TYPE_PTR:   return "PTR";
+        case DNS_TYPE_MX:    return "MX";
+        case DNS_TYPE_TXT:   return "TXT";
+        case DNS_TYPE_AAAA:  return "AAAA";
+        case DNS_TYPE_SRV:   return "SRV";
+        case DNS_TYPE_SVCB:  return "SVCB";
+        case DNS_TYPE_HTTPS: return "HTTPS";
+        case DNS_TYPE_ANY:   return "ANY";
+        default:             return "TYPE" + std::to_string(type);
+    }
+}
+
+
 void dns_record_t::write(
     buffer &bio )
 {
@@ -261,17 +470,19 @@ DNSCache::~DNSCache()
 }
 
 
+// ID of the queries sent to the external DNS
+static std::atomic<uint16_t> dns_lastId(1);
+
+
 int DNSCache::recursive(
     const std::string &host,
     int type,
     const Address &dnsAddress,
     Address &output )
 {
-    static std::atomic<uint16_t> lastId(1);
-
     // build the query message
     dns_message_t message;
-    message.header.id = lastId.fetch_add(1);
+    message.header.id = dns_lastId.fetch_add(1);
     message.header.flags |= DNS_FLAG_RD;
     message.header.flags |= DNS_FLAG_AD;
     dns_question_t question;
@@ -325,6 +536,8 @@ void DNSCache::reset()
 {
     std::lock_guard<std::mutex> raii(lock_);
     cache_.clear();
+    packets_.clear();
+    expiries_.clear();
 }
 
 
@@ -350,19 +563,55 @@ void DNSCache::cleanup( uint32_t ttl )
 }
 
 
-Address DNSCache::nameserver( const std::string &host )
+/*
+ * Find a valid cache entry for the question of the request, without
+ * resolving anything.
+ */
+bool DNSCache::find( const dns_message_view &request, Address &output )
 {
+    char host[DNS_NAME_SIZE];
+    size_t length = request.name(host);
+    std::string key(host, length);
+    key += (request.qtype == ADDR_TYPE_AAAA) ? ":6" : ":4";
+
     std::lock_guard<std::mutex> raii(lock_);
+    return find(key, dns_time(), output);
+}
+
+
+// the caller must hold 'lock_'
+bool DNSCache::find( const std::string &key, uint32_t now, Address &output )
+{
+    auto it = cache_.find(key);
+    // check whether the cache entry still valid
+    if (it == cache_.end() || now > it->second.timestamp + ttl_ || it->second.address.invalid()) return false;
+    output = it->second.address;
+    ++hits_.cache;
+    it->second.timestamp = now;
+    return true;
+}
+
 
-    const Node<Address> *node = targets_.match(host);
-    if (node == nullptr) return defaultDNS_;
-    return node->value;
+/*
+ * Resolve a host name. 'upstream' is the index of the external DNS server
+ * (see 'addUpstream') chosen by the rules, or -1 to use the default one.
+ */
+int DNSCache::resolve(
+    const dns_message_view &request,
+    int upstream,
+    Address &dnsAddress,
+    Address &output )
+{
+    char host[DNS_NAME_SIZE];
+    size_t length = request.name(host);
+    return resolve(std::string(host, length), request.qtype, upstream, dnsAddress, output);
 }
 
 
 int DNSCache::resolve(
     const std::string &host,
     int type,
+    int upstream,
     Address &dnsAddress,
     Address &output )
 {
@@ -379,27 +628,13 @@ int DNSCache::resolve(
         dnsAddress = Address();
         output = Address();
 
-        auto it = cache_.find(key);
         // try to use cache information
-        if (it != cache_.end())
-        {
-            // check whether the cache entry still valid
-            if (currentTime <= it->second.timestamp + ttl_)
-            {
-                output = it->second.address;
-                if (!output.invalid())
-                {
-                    ++hits_.cache;
-                    it->second.timestamp = currentTime;
-                    return DNSB_STATUS_CACHE;
-                }
-            }
-        }
+        if (find(key, currentTime, output)) return DNSB_STATUS_CACHE;
 
         // check if we have a specific DNS server for this domain
         dnsAddress = defaultDNS_;
-        const Node<Address> *node = targets_.match(host);
-        if (node != nullptr && !node->value.invalid()) dnsAddress = node->value;
+        if (upstream >= 0 && upstream < (int) upstreams_.size() && !upstreams_[upstream].invalid())
+            dnsAddress = upstreams_[upstream];
     }
 
     bool store = true;
@@ -434,6 +669,304 @@ int DNSCache::resolve(
 }
 
 
+// cache key of the responses of any other type: the host name and the type (and the class, if not IN)
+static std::string dns_packetKey( const dns_message_view &request )
+{
+    char host[DNS_NAME_SIZE];
+    size_t length = request.name(host);
+    std::string key(host, length);
+    key += '/';
+    key += std::to_string(request.qtype);
+    if (request.qclass != 1)
+    {
+        key += '/';
+        key += std::to_string(request.qclass);
+    }
+    return key;
+}
+
+
+static uint16_t dns_readU16( const uint8_t *data )
+{
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+
+static uint32_t dns_readU32( const uint8_t *data )
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+
+/*
+ * Send the request as received to the external DNS (with an ID of our own)
+ * and wait for a response to the same question. The response gets the ID and
+ * the QNAME (with the case) of the request. 'output' must have room for
+ * DNS_PACKET_SIZE bytes.
+ */
+int DNSCache::exchange(
+    const dns_message_view &request,
+    const Address &dnsAddress,
+    uint8_t *output,
+    size_t *size )
+{
+    uint16_t id = dns_lastId.fetch_add(1);
+    memcpy(output, request.data, request.size);
+    output[0] = (uint8_t) (id >> 8);
+    output[1] = (uint8_t) id;
+    // don't accept responses larger than we can receive
+    if (request.udpSize > DNS_PACKET_SIZE)
+    {
+        output[request.questionEnd() + 3] = (uint8_t) (DNS_PACKET_SIZE >> 8);
+        output[request.questionEnd() + 4] = (uint8_t) DNS_PACKET_SIZE;
+    }
+
+    Endpoint endpoint(dnsAddress, 53);
+    UDP conn;
+    if (!conn.send(endpoint, output, request.size)) return DNSB_STATUS_FAILURE;
+    if (!conn.poll(timeout_)) return DNSB_STATUS_FAILURE;
+
+    *size = DNS_PACKET_SIZE;
+    if (!conn.receive(endpoint, output, size)) return DNSB_STATUS_FAILURE;
+
+    // the response must answer the same question
+    size_t end = request.questionEnd();
+    if (*size < end ||
+        dns_readU16(output) != id ||
+        (dns_readU16(output + 2) & DNS_FLAG_QR) == 0 ||
+        dns_readU16(output + 4) != 1 ||
+        memcmp(output + end - 4, request.data + end - 4, 4) != 0)
+        return DNSB_STATUS_FAILURE;
+    const uint8_t *qname = request.qname();
+    for (size_t i = 0; i < request.qnameSize; ++i)
+    {
+        uint8_t c = output[request.qnameOffset + i];
+        if (c != qname[i] && ((c | 0x20) != (qname[i] | 0x20) || (c | 0x20) < 'a' || (c | 0x20) > 'z'))
+            return DNSB_STATUS_FAILURE;
+    }
+
+    output[0] = request.data[0];
+    output[1] = request.data[1];
+    memcpy(output + request.qnameOffset, qname, request.qnameSize);
+    return DNSB_STATUS_RECURSIVE;
+}
+
+
+/*
+ * Replace a response larger than the client accepts by an empty truncated
+ * response, so the client retries over TCP.
+ */
+static void dns_truncate( const dns_message_view &request, uint8_t *output, size_t *size )
+{
+    if (*size <= request.udpSize) return;
+    *size = request.questionEnd();
+    output[2] |= DNS_FLAG_TC >> 8;
+    memset(output + 6, 0, 6);
+}
+
+
+/*
+ * Keep a copy of the response with the position of its TTLs. Only complete
+ * answers and NXDOMAIN are kept, for as long as their smallest TTL; the SOA
+ * record of negative answers counts with the smallest of its TTL and its
+ * MINIMUM field (RFC-2308 5). The OPT record of the external DNS is not kept,
+ * since it only applies to the request that was forwarded (see 'find'). The
+ * caller must hold 'lock_'.
+ */
+void DNSCache::store( const std::string &key, uint32_t now, const uint8_t *data, size_t size )
+{
+    uint16_t flags = dns_readU16(data + 2);
+    int rcode = DNS_GET_RCODE(flags);
+    if ((flags & DNS_FLAG_TC) || (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN)) return;
+
+    dns_packet_t entry;
+    entry.lifetime = (uint32_t) ttl_;
+    size_t count = (size_t) dns_readU16(data + 6) + dns_readU16(data + 8) + dns_readU16(data + 10);
+    bool negative = rcode == DNS_RCODE_NXDOMAIN || dns_readU16(data + 6) == 0;
+    size_t opt = 0;
+
+    // skip the question (already validated)
+    size_t offset = DNS_HEADER_SIZE;
+    while (data[offset] != 0) offset += data[offset] + 1U;
+    offset += 5;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        // the OPT record must be the last one, so removing it moves nothing
+        if (opt != 0) return;
+        size_t start = offset;
+        // owner name, which ends with the root label or a compression pointer
+        while (offset < size && data[offset] != 0 && (data[offset] & 0xC0) == 0) offset += data[offset] + 1U;
+        if (offset >= size) return;
+        offset += (data[offset] == 0) ? 1 : 2;
+        if (offset + 10 > size) return;
+
+        uint16_t type = dns_readU16(data + offset);
+        uint16_t rdlen = dns_readU16(data + offset + 8);
+        if (type == DNS_TYPE_OPT)
+            opt = start;
+        else
+        {
+            entry.ttls.push_back((uint16_t) (offset + 4));
+            uint32_t ttl = dns_readU32(data + offset + 4);
+            if (negative && type == DNS_TYPE_SOA && rdlen >= 20 && offset + 10U + rdlen <= size)
+                ttl = std::min(ttl, dns_readU32(data + offset + 6 + rdlen));
+            if (ttl < entry.lifetime) entry.lifetime = ttl;
+        }
+        offset += 10U + rdlen;
+    }
+    if (offset != size || entry.ttls.empty() || entry.lifetime == 0) return;
+    // leave room for our OPT record
+    if (opt != 0) size = opt;
+    if (size + DNS_OPT_SIZE > DNS_PACKET_SIZE) return;
+
+    auto current = packets_.find(key);
+    if (current != packets_.end())
+    {
+        expiries_.erase(current->second.expiry);
+        packets_.erase(current);
+    }
+    // drop the expired entries, or the one expiring first if none did, to make room
+    while (!expiries_.empty() && ((int) packets_.size() >= size_ || expiries_.begin()->first <= now))
+    {
+        packets_.erase(expiries_.begin()->second);
+        expiries_.erase(expiries_.begin());
+    }
+    if ((int) packets_.size() >= size_) return;
+
+    entry.data.assign(data, data + size);
+    if (opt != 0)
+    {
+        uint16_t arcount = (uint16_t) (dns_readU16(data + 10) - 1);
+        entry.data[10] = (uint8_t) (arcount >> 8);
+        entry.data[11] = (uint8_t) arcount;
+    }
+    entry.timestamp = now;
+    entry.expiry = expiries_.emplace(now + entry.lifetime, key);
+    ++hits_.external;
+    packets_.emplace(key, std::move(entry));
+}
+
+
+/*
+ * Copy a valid response from the cache with the ID and the QNAME of the
+ * request and the TTLs decremented by the time spent in the cache. Requests
+ * with EDNS get an OPT record of our own. The caller must hold 'lock_'.
+ */
+bool DNSCache::find(
+    const std::string &key,
+    uint32_t now,
+    const dns_message_view &request,
+    uint8_t *output,
+    size_t *size )
+{
+    auto it = packets_.find(key);
+    if (it == packets_.end()) return false;
+    const dns_packet_t &entry = it->second;
+    uint32_t elapsed = now - entry.timestamp;
+    if (elapsed >= entry.lifetime) return false;
+    ++hits_.cache;
+
+    // only the header and the question are copied if the response will be truncated
+    *size = entry.data.size() + ((request.edns) ? DNS_OPT_SIZE : 0);
+    memcpy(output, entry.data.data(), (*size > request.udpSize) ? request.questionEnd() : entry.data.size());
+    output[0] = request.data[0];
+    output[1] = request.data[1];
+    memcpy(output + request.qnameOffset, request.qname(), request.qnameSize);
+    if (*size > request.udpSize)
+    {
+        dns_truncate(request, output, size);
+        return true;
+    }
+
+    for (auto ttl = entry.ttls.begin(); ttl != entry.ttls.end(); ++ttl)
+    {
+        uint32_t value = dns_readU32(output + *ttl) - elapsed;
+        output[*ttl] = (uint8_t) (value >> 24);
+        output[*ttl + 1] = (uint8_t) (value >> 16);
+        output[*ttl + 2] = (uint8_t) (value >> 8);
+        output[*ttl + 3] = (uint8_t) value;
+    }
+
+    if (request.edns)
+    {
+        // the payload size we accept and the DO bit of the request (RFC-3225 3)
+        uint8_t *opt = output + entry.data.size();
+        memset(opt, 0, DNS_OPT_SIZE);
+        opt[2] = (uint8_t) DNS_TYPE_OPT;
+        opt[3] = (uint8_t) (DNS_BUFFER_SIZE >> 8);
+        opt[4] = (uint8_t) DNS_BUFFER_SIZE;
+        opt[7] = (uint8_t) (request.data[request.questionEnd() + 7] & 0x80);
+        uint16_t arcount = (uint16_t) (dns_readU16(output + 10) + 1);
+        output[10] = (uint8_t) (arcount >> 8);
+        output[11] = (uint8_t) arcount;
+    }
+    return true;
+}
+
+
+/*
+ * Find a valid response in the cache for the question of the request, without
+ * forwarding anything. 'output' must have room for DNS_PACKET_SIZE bytes.
+ */
+bool DNSCache::find( const dns_message_view &request, uint8_t *output, size_t *size )
+{
+    std::string key = dns_packetKey(request);
+    std::lock_guard<std::mutex> raii(lock_);
+    return find(key, dns_time(), request, output, size);
+}
+
+
+/*
+ * Forward a query of any type to the external DNS and cache the response as
+ * received. 'upstream' is handled like in 'resolve'. 'output' must have room
+ * for DNS_PACKET_SIZE bytes.
+ */
+int DNSCache::forward(
+    const dns_message_view &request,
+    int upstream,
+    Address &dnsAddress,
+    uint8_t *output,
+    size_t *size )
+{
+    uint32_t currentTime = dns_time();
+    std::string key = dns_packetKey(request);
+
+    {
+        std::lock_guard<std::mutex> raii(lock_);
+
+        if (find(key, currentTime, request, output, size))
+        {
+            dnsAddress = Address();
+            return DNSB_STATUS_CACHE;
+        }
+
+        dnsAddress = defaultDNS_;
+        if (upstream >= 0 && upstream < (int) upstreams_.size() && !upstreams_[upstream].invalid())
+            dnsAddress = upstreams_[upstream];
+    }
+
+    bool cacheable = true;
+    int result = exchange(request, dnsAddress, output, size);
+    if (result == DNSB_STATUS_FAILURE && !(dnsAddress == defaultDNS_))
+    {
+        // try again using the default DNS server, but don't cache the response
+        cacheable = false;
+        dnsAddress = defaultDNS_;
+        result = exchange(request, defaultDNS_, output, size);
+    }
+    if (result != DNSB_STATUS_RECURSIVE) return result;
+
+    if (cacheable)
+    {
+        std::lock_guard<std::mutex> raii(lock_);
+        store(key, currentTime, output, *size);
+    }
+    dns_truncate(request, output, size);
+    return result;
+}
+
+
 void DNSCache::dump( const std::string &path )
 {
     std::lock_guard<std::mutex> raii(lock_);
@@ -468,8 +1001,31 @@ void DNSCache::dump( const std::string &path )
             ++it;
         }
 
+        for (auto it = packets_.begin(); it != packets_.end();)
+        {
+            uint32_t elapsed = now - it->second.timestamp;
+            if (elapsed >= it->second.lifetime)
+            {
+                expiries_.erase(it->second.expiry);
+                it = packets_.erase(it);
+                ++removed;
+                continue;
+            }
+
+            // the type of the question in place of the address
+            const uint8_t *qtype = it->second.data.data() + DNS_HEADER_SIZE;
+            while (*qtype != 0) qtype += *qtype + 1;
+            fprintf(output, "%-16s  %6d  %s\n",
+                dns_typeName(dns_readU16(qtype + 1)).c_str(),
+                it->second.lifetime - elapsed,
+                it->first.c_str());
+
+            ++it;
+        }
+
         if (removed > 0)
-            LOG_MESSAGE("\nCache: removed %d entries and kept %d entries\n\n", removed, cache_.size());
+            LOG_MESSAGE("\nCache: removed %d entries and kept %d entries\n\n", removed,
+                cache_.size() + packets_.size());
 
         fclose(output);
     }
@@ -493,10 +1049,15 @@ void DNSCache::setDefaultDNS( const std::string &dns, const std::string &name )
 }
 
 
-void DNSCache::addTarget( const std::string &rule, const std::string &dns, const std::string &name )
+/*
+ * Register an external DNS server that rules can choose. Returns the index
+ * given to 'resolve'.
+ */
+int DNSCache::addUpstream( const std::string &dns, const std::string &name )
 {
     std::lock_guard<std::mutex> raii(lock_);
-    targets_.add(rule, Address(UDP::hostToIPv4(dns), name) );
+    upstreams_.push_back(Address(UDP::hostToIPv4(dns), name));
+    return (int) upstreams_.size() - 1;
 }
 
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <map>
 #include "defs.hh"
 #include "log.hh"
 #include "nodes.hh"
@@ -23,6 +24,15 @@
 #define DNS_FLAG_AD           (1 <<  5) // Authentic Data
 #define DNS_FLAG_CD           (1 <<  4) // Checking Disabled
 
+#define DNS_HEADER_SIZE       12
+#define DNS_NAME_SIZE         255 // maximum size of a name in wire format (RFC-1035 2.3.4)
+#define DNS_QNAME_POINTER     0xC00C // compression pointer to the QNAME of the question
+#define DNS_ANSWER_SIZE       28  // size of the largest answer record (AAAA)
+#define DNS_RESPONSE_SIZE     (DNS_HEADER_SIZE + DNS_NAME_SIZE + 4 + DNS_ANSWER_SIZE)
+#define DNS_PACKET_SIZE       4096 // largest response relayed from the external DNS
+#define DNS_UDP_SIZE          512 // size of UDP messages without EDNS (RFC-1035 4.2.1)
+#define DNS_OPT_SIZE          11  // size of an OPT record without options (RFC-6891 6.1.2)
+
 #define DNS_IP_O1(x)          (((x) & 0xFF000000) >> 24)
 #define DNS_IP_O2(x)          (((x) & 0x00FF0000) >> 16)
 #define DNS_IP_O3(x)          (((x) & 0x0000FF00) >> 8)
@@ -31,10 +41,18 @@
 #define DNS_TYPE_A            (uint16_t) 1
 #define DNS_TYPE_NS           (uint16_t) 2
 #define DNS_TYPE_CNAME        (uint16_t) 5
+#define DNS_TYPE_SOA          (uint16_t) 6
 #define DNS_TYPE_PTR          (uint16_t) 12
 #define DNS_TYPE_MX           (uint16_t) 15
 #define DNS_TYPE_TXT          (uint16_t) 16
 #define DNS_TYPE_AAAA         (uint16_t) 28
+#define DNS_TYPE_SRV          (uint16_t) 33
+#define DNS_TYPE_OPT          (uint16_t) 41
+#define DNS_TYPE_SVCB         (uint16_t) 64
+#define DNS_TYPE_HTTPS        (uint16_t) 65
+#define DNS_TYPE_IXFR         (uint16_t) 251
+#define DNS_TYPE_AXFR         (uint16_t) 252
+#define DNS_TYPE_ANY          (uint16_t) 255
 
 #define DNSB_STATUS_CACHE        1
 #define DNSB_STATUS_RECURSIVE    2
@@ -108,12 +126,65 @@ struct dns_message_t
     void print() const;
 };
 
+/*
+ * Non-owning view of a query in wire format. 'read' validates the header and
+ * the first question in place and keeps their fields and the position of the
+ * QNAME, without allocating anything, so queries can be refused before being
+ * copied. The view is valid as long as the message is.
+ */
+struct dns_message_view
+{
+    const uint8_t *data;
+    size_t size;
+    uint16_t id;
+    uint16_t flags;
+    uint16_t qdcount;
+    uint16_t qtype;
+    uint16_t qclass;
+    size_t qnameOffset;  // position of the QNAME (right after the header)
+    size_t qnameSize;    // size of the QNAME, including the root label
+    size_t length;       // length of the QNAME in text form
+    size_t labels;       // number of labels of the QNAME
+    uint16_t udpSize;    // largest response the client accepts over UDP (EDNS)
+    bool edns;           // whether the question is followed by an OPT record
+
+    dns_message_view();
+    bool read( const uint8_t *data, size_t size );
+    size_t name( char *output ) const;
+
+    // the QNAME in wire format
+    inline const uint8_t *qname() const
+    {
+        return data + qnameOffset;
+    }
+
+    // position of the first byte after the question
+    inline size_t questionEnd() const
+    {
+        return qnameOffset + qnameSize + 4;
+    }
+};
+
+size_t dns_error( const dns_message_view &request, int rcode, uint8_t *output );
+size_t dns_answer( const dns_message_view &request, const Address *address, uint8_t *output );
+std::string dns_typeName( uint16_t type );
+
 struct dns_cache_t
 {
     uint32_t timestamp;
     Address address;
 };
 
+// response of the external DNS cached as received
+struct dns_packet_t
+{
+    std::vector<uint8_t> data;
+    std::vector<uint16_t> ttls; // position of the TTL of each record
+    uint32_t timestamp;         // when the response was received
+    uint32_t lifetime;          // smallest TTL of the records (limited by the cache TTL)
+    std::multimap<uint32_t, std::string>::iterator expiry; // entry in 'DNSCache::expiries_'
+};
+
 
 struct DNSCache
 {
@@ -124,19 +195,29 @@ struct DNSCache
             int timeout = DNS_TIMEOUT );
 
         ~DNSCache();
-        int resolve( const std::string &host, int type, Address &dnsAddress, Address &output );
+        int resolve( const std::string &host, int type, int upstream, Address &dnsAddress, Address &output );
+        int resolve( const dns_message_view &request, int upstream, Address &dnsAddress, Address &output );
+        bool find( const dns_message_view &request, Address &output );
+        int forward( const dns_message_view &request, int upstream, Address &dnsAddress, uint8_t *output,
+            size_t *size );
+        bool find( const dns_message_view &request, uint8_t *output, size_t *size );
         void dump( const std::string &path );
         void cleanup( uint32_t ttl );
         void reset();
         void setDefaultDNS( const std::string &dns, const std::string &name );
-        void addTarget( const std::string &rule, const std::string &dns, const std::string &name );
+        int addUpstream( const std::string &dns, const std::string &name );
 
     private:
         int size_;
         int ttl_;
         Address defaultDNS_;
         std::unordered_map<std::string, dns_cache_t> cache_;
-        Tree<Address> targets_;
+        // responses of any other type, by name and type
+        std::unordered_map<std::string, dns_packet_t> packets_;
+        // keys of 'packets_' by expiration time, so a full cache drops the entries expiring first
+        std::multimap<uint32_t, std::string> expiries_;
+        // external DNS servers chosen by the rules, by index
+        std::vector<Address> upstreams_;
         struct
         {
             uint32_t cache;
@@ -146,7 +227,14 @@ struct DNSCache
         std::mutex lock_;
 
         int recursive( const std::string &host, int type, const Address &dnsAddress, Address &address );
-        Address nameserver( const std::string &host );
+        bool find( const std::string &key, uint32_t now, Address &output );
+        int exchange( const dns_message_view &request, const Address &dnsAddress, uint8_t *output, size_t *size );
+        bool find( const std::string &key, uint32_t now, const dns_message_view &request, uint8_t *output,
+            size_t *size );
+        void store( const std::string &key, uint32_t now, const uint8_t *data, size_t size );
+
+        // stores and finds responses at given times (see 'tests.cc')
+        friend struct DNSCacheTest;
 };
 
 }
@@ -0,0 +1,155 @@
+#include "filter.hh"
+#include "nodes.hh"
+
+#define FILTER_BITS_PER_KEY   12
+#define FILTER_BLOCK_WORDS    8   // 512 bits per block
+#define FILTER_PROBES         6
+#define FILTER_SAMPLES        100000
+
+namespace dnsblocker {
+
+// MurmurHash3 finalizer, used to derive the second hash
+static uint32_t filter_mix( uint32_t h )
+{
+    h ^= h >> 16;
+    h *= 0x85EBCA6BU;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35U;
+    h ^= h >> 16;
+    return h;
+}
+
+// FNV-1a step; host names are hashed from right to left so every label suffix
+// is hashed in a single pass
+static inline uint32_t filter_step( uint32_t h, char c )
+{
+    if (c >= 'A' && c <= 'Z') c = (char) (c + 32);
+    return (h ^ (uint8_t) c) * 16777619U;
+}
+
+BloomFilter::BloomFilter() : blocks_(0)
+{
+}
+
+uint32_t BloomFilter::hash( const std::string &rule )
+{
+    return hash(rule.c_str(), rule.length());
+}
+
+uint32_t BloomFilter::hash( const char *rule, size_t length )
+{
+    size_t start = 0;
+    while (start < length && (rule[start] == '*' || rule[start] == '.')) ++start;
+    uint32_t h = 2166136261U;
+    for (size_t i = length; i > start; --i) h = filter_step(h, rule[i - 1]);
+    return h;
+}
+
+void BloomFilter::insert( uint32_t hash )
+{
+    uint32_t h2 = filter_mix(hash);
+    uint64_t *block = bits_.data() + (size_t) (((uint64_t) h2 * blocks_) >> 32) * FILTER_BLOCK_WORDS;
+    for (uint32_t i = 0; i < FILTER_PROBES; ++i)
+    {
+        uint32_t bit = (hash + i * (h2 | 1)) & (FILTER_BLOCK_WORDS * 64 - 1);
+        block[bit >> 6] |= (uint64_t) 1 << (bit & 63);
+    }
+}
+
+bool BloomFilter::probe( uint32_t hash ) const
+{
+    uint32_t h2 = filter_mix(hash);
+    const uint64_t *block = bits_.data() + (size_t) (((uint64_t) h2 * blocks_) >> 32) * FILTER_BLOCK_WORDS;
+    for (uint32_t i = 0; i < FILTER_PROBES; ++i)
+    {
+        uint32_t bit = (hash + i * (h2 | 1)) & (FILTER_BLOCK_WORDS * 64 - 1);
+        if ((block[bit >> 6] & ((uint64_t) 1 << (bit & 63))) == 0) return false;
+    }
+    return true;
+}
+
+void BloomFilter::build( const std::vector<uint32_t> &hashes )
+{
+    clear();
+    if (hashes.empty()) return;
+    size_t bits = hashes.size() * FILTER_BITS_PER_KEY;
+    blocks_ = (uint32_t) ((bits + FILTER_BLOCK_WORDS * 64 - 1) / (FILTER_BLOCK_WORDS * 64));
+    bits_.resize((size_t) blocks_ * FILTER_BLOCK_WORDS, 0);
+    for (auto it = hashes.begin(); it != hashes.end(); ++it) insert(*it);
+}
+
+// add a key to a built filter (its false positive rate grows with each key)
+void BloomFilter::add( uint32_t hash )
+{
+    if (!bits_.empty()) insert(hash);
+}
+
+bool BloomFilter::contains( const std::string &host ) const
+{
+    if (bits_.empty()) return true;
+
+    uint32_t h = 2166136261U;
+    for (size_t i = host.length(); i > 0; --i)
+    {
+        h = filter_step(h, host[i - 1]);
+        if ((i == 1 || host[i - 2] == '.') && probe(h)) return true;
+    }
+    return false;
+}
+
+// same as above for a host name in DNS wire format
+bool BloomFilter::contains( const uint8_t *qname, size_t size ) const
+{
+    if (bits_.empty()) return true;
+
+    WireName name;
+    if (!name.read(qname, size)) return true;
+
+    uint32_t h = 2166136261U;
+    for (char c = name.next(); c != 0;)
+    {
+        h = filter_step(h, c);
+        c = name.next();
+        if ((c == 0 || c == '.') && probe(h)) return true;
+    }
+    return false;
+}
+
+void BloomFilter::clear()
+{
+    bits_.clear();
+    bits_.shrink_to_fit();
+    blocks_ = 0;
+}
+
+bool BloomFilter::empty() const
+{
+    return bits_.empty();
+}
+
+size_t BloomFilter::memory() const
+{
+    return bits_.size() * sizeof(uint64_t) + sizeof(BloomFilter);
+}
+
+/*
+ * Estimate the false positive rate of a single probe (i.e. per label suffix)
+ * using random keys.
+ */
+float BloomFilter::falsePositiveRate() const
+{
+    if (bits_.empty()) return 1.0F;
+    uint32_t state = 0x9E3779B9U;
+    int hits = 0;
+    for (int i = 0; i < FILTER_SAMPLES; ++i)
+    {
+        // xorshift32
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        if (probe(state)) ++hits;
+    }
+    return (float) hits / (float) FILTER_SAMPLES;
+}
+
+}
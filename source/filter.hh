@@ -0,0 +1,41 @@
+#ifndef DNSB_FILTER_HH
+#define DNSB_FILTER_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dnsblocker {
+
+/*
+ * Blocked Bloom filter over rule domains. Every probe touches a single
+ * 64-byte block, and a host name is checked by probing each of its label
+ * suffixes. A negative answer means no rule can match the host; a positive
+ * answer must be confirmed by the rule tree.
+ */
+class BloomFilter
+{
+    public:
+        BloomFilter();
+        void build( const std::vector<uint32_t> &hashes );
+        void add( uint32_t hash );
+        bool contains( const std::string &host ) const;
+        bool contains( const uint8_t *qname, size_t size ) const;
+        void clear();
+        bool empty() const;
+        size_t memory() const;
+        float falsePositiveRate() const;
+        static uint32_t hash( const std::string &rule );
+        static uint32_t hash( const char *rule, size_t length );
+
+    private:
+        std::vector<uint64_t> bits_;
+        uint32_t blocks_;
+
+        bool probe( uint32_t hash ) const;
+        void insert( uint32_t hash );
+};
+
+}
+
+#endif // DNSB_FILTER_HH
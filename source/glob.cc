@@ -0,0 +1,295 @@
+#include "glob.hh"
+#include "nodes.hh"
+#include <algorithm>
+#include <unordered_map>
+
+#define GLOB_NONE          UINT32_MAX
+#define GLOB_ANY           (((uint64_t) 1 << NODE_SLOTS) - 1)
+#define GLOB_LABEL         (GLOB_ANY & ~((uint64_t) 1 << 37)) // anything but the period
+
+namespace dnsblocker {
+
+/*
+ * State of the nondeterministic automaton built from the patterns. Each
+ * pattern becomes a chain of states, one per symbol or asterisk, read from
+ * the end of the pattern (the order the host names are fed).
+ */
+struct GlobState
+{
+    int symbol;       // symbol that leads to the next state (-1 if none)
+    uint64_t loop;    // symbols that keep the automaton in this state
+    uint32_t skip;    // state reached without consuming symbols (GLOB_NONE if none)
+    uint8_t output;   // verdicts of the pattern, in its last state
+
+    GlobState( int symbol = -1, uint64_t loop = 0, uint32_t skip = GLOB_NONE ) : symbol(symbol),
+        loop(loop), skip(skip), output(0)
+    {
+    }
+};
+
+// FNV-1a over the states of a set
+struct GlobSetHash
+{
+    size_t operator()( const std::vector<uint32_t> &value ) const
+    {
+        uint32_t h = 2166136261U;
+        for (auto it = value.begin(); it != value.end(); ++it) h = (h ^ *it) * 16777619U;
+        return h;
+    }
+};
+
+GlobRules::GlobRules()
+{
+}
+
+size_t GlobRules::size() const
+{
+    return patterns_.size();
+}
+
+size_t GlobRules::memory() const
+{
+    size_t total = automaton_.memory() + sizeof(GlobRules);
+    for (auto it = patterns_.begin(); it != patterns_.end(); ++it) total += it->first.capacity() + 48;
+    return total;
+}
+
+bool GlobRules::isPattern( const std::string &rule )
+{
+    return isPattern(rule.c_str(), rule.length());
+}
+
+/*
+ * Returns whether the rule has an asterisk other than a leading '*.' or '**.'.
+ */
+bool GlobRules::isPattern( const char *rule, size_t length )
+{
+    size_t i = 0;
+    while (i < length && (rule[i] == ' ' || rule[i] == '\t')) ++i;
+    if (i + 2 < length && rule[i] == '*' && rule[i + 1] == '*' && rule[i + 2] == '.')
+        i += 3;
+    else
+    if (i + 1 < length && rule[i] == '*' && rule[i + 1] == '.')
+        i += 2;
+    for (; i < length && rule[i] != ' ' && rule[i] != '\t'; ++i)
+        if (rule[i] == '*') return true;
+    return false;
+}
+
+/*
+ * Validate a rule and convert it to normal form (lowercase, without repeated
+ * asterisks).
+ */
+int GlobRules::parse( const char *rule, size_t length, std::string &pattern, std::string *clean )
+{
+    if (rule == nullptr || length == 0 || length > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    // copy ignoring leading and trailing whitespaces
+    size_t start = 0;
+    while (start < length && (rule[start] == ' ' || rule[start] == '\t')) ++start;
+    size_t end = start;
+    while (end < length && rule[end] != ' ' && rule[end] != '\t') ++end;
+    std::string temp(rule + start, end - start);
+    if (clean != nullptr) *clean = temp;
+
+    size_t prefix = 0;
+    if (temp.compare(0, 3, "**.") == 0)
+        prefix = 3;
+    else
+    if (temp.compare(0, 2, "*.") == 0)
+        prefix = 2;
+
+    if (temp.length() == prefix || temp[prefix] == '.' || temp.back() == '.') return DNSBERR_INVALID_ARGUMENT;
+    pattern = temp.substr(0, prefix);
+    bool wildcard = false;
+    for (size_t i = prefix; i < temp.length(); ++i)
+    {
+        char c = temp[i];
+        if (c == '*')
+        {
+            if (!wildcard) pattern += c;
+            wildcard = true;
+            continue;
+        }
+        if (charToIndex(c) < 0) return DNSBERR_INVALID_ARGUMENT;
+        if (c >= 'A' && c <= 'Z') c = (char) (c + 32);
+        pattern += c;
+        wildcard = false;
+    }
+    if (pattern.find('*', prefix) == std::string::npos) return DNSBERR_INVALID_RULE;
+    return DNSBERR_OK;
+}
+
+int GlobRules::add( const std::string &rule, uint8_t verdict, std::string *clean )
+{
+    return add(rule.c_str(), rule.length(), verdict, clean);
+}
+
+/*
+ * Add a pattern with the given verdicts. The automaton is only updated by
+ * 'compile'.
+ */
+int GlobRules::add( const char *rule, size_t length, uint8_t verdict, std::string *clean )
+{
+    std::string pattern;
+    int result = parse(rule, length, pattern, clean);
+    if (result != DNSBERR_OK) return result;
+
+    uint8_t &current = patterns_[pattern];
+    if ((current & verdict) == verdict) return DNSBERR_DUPLICATED_RULE;
+    current = (uint8_t) (current | verdict);
+    return DNSBERR_OK;
+}
+
+/*
+ * Remove verdicts added with 'add'. The automaton is only updated by
+ * 'compile'.
+ */
+int GlobRules::remove( const std::string &rule, uint8_t verdict )
+{
+    std::string pattern;
+    int result = parse(rule.c_str(), rule.length(), pattern, nullptr);
+    if (result != DNSBERR_OK) return result;
+
+    auto it = patterns_.find(pattern);
+    if (it == patterns_.end() || (it->second & verdict) == 0) return DNSBERR_MISSING_RULE;
+    it->second = (uint8_t) (it->second & ~verdict);
+    if (it->second == 0) patterns_.erase(it);
+    return DNSBERR_OK;
+}
+
+/*
+ * Build the automaton of the current patterns: a nondeterministic automaton
+ * with a chain of states per pattern is converted by subset construction and
+ * then minimized. Returns false (leaving the automaton empty) if it would
+ * have more than GLOB_MAX_STATES states.
+ */
+bool GlobRules::compile()
+{
+    automaton_.clear();
+    if (patterns_.empty()) return true;
+
+    std::vector<GlobState> states;
+    std::vector<uint32_t> initial;
+    for (auto it = patterns_.begin(); it != patterns_.end(); ++it)
+    {
+        const std::string &pattern = it->first;
+        size_t prefix = 0;
+        if (pattern.compare(0, 3, "**.") == 0)
+            prefix = 3;
+        else
+        if (pattern.compare(0, 2, "*.") == 0)
+            prefix = 2;
+        initial.push_back((uint32_t) states.size());
+
+        // the domain, from the last character
+        for (size_t i = pattern.length(); i > prefix; --i)
+        {
+            if (pattern[i - 1] == '*')
+                states.push_back(GlobState(-1, GLOB_LABEL, (uint32_t) states.size() + 1));
+            else
+                states.push_back(GlobState(charToIndex(pattern[i - 1])));
+        }
+        // '*.' requires a period and anything before it; '**.' also matches the domain itself
+        if (prefix > 0)
+        {
+            uint32_t last = (uint32_t) states.size() + 2;
+            states.push_back(GlobState(charToIndex('.'), 0, (prefix == 3) ? last : GLOB_NONE));
+            states.push_back(GlobState(-1, GLOB_ANY, last));
+        }
+        states.push_back(GlobState());
+        states.back().output = it->second;
+    }
+
+    std::vector<uint32_t> stamps(states.size(), 0);
+    uint32_t stamp = 0;
+    std::vector<uint32_t> current;
+    // add a state and the states reached from it without consuming symbols
+    auto include = [&states, &stamps, &stamp, &current]( uint32_t state )
+    {
+        for (; state != GLOB_NONE && stamps[state] != stamp; state = states[state].skip)
+        {
+            stamps[state] = stamp;
+            current.push_back(state);
+        }
+    };
+    auto output = [&states]( const std::vector<uint32_t> &set )
+    {
+        uint8_t result = 0;
+        for (auto it = set.begin(); it != set.end(); ++it) result = (uint8_t) (result | states[*it].output);
+        return result;
+    };
+
+    std::unordered_map<std::vector<uint32_t>, uint32_t, GlobSetHash> index;
+    std::vector< std::vector<uint32_t> > sets(2);
+    ++stamp;
+    for (auto it = initial.begin(); it != initial.end(); ++it) include(*it);
+    std::sort(current.begin(), current.end());
+    sets[AUTOMATON_START] = current;
+    index[current] = AUTOMATON_START;
+    automaton_.add(0);
+    automaton_.add(output(current));
+
+    std::vector<uint32_t> set;
+    for (uint32_t state = AUTOMATON_START; state < sets.size(); ++state)
+    {
+        // 'index' keeps a copy of the set
+        set.swap(sets[state]);
+        for (int symbol = 0; symbol < NODE_SLOTS; ++symbol)
+        {
+            current.clear();
+            ++stamp;
+            uint64_t bit = (uint64_t) 1 << symbol;
+            for (auto it = set.begin(); it != set.end(); ++it)
+            {
+                if (states[*it].symbol == symbol) include(*it + 1);
+                if (states[*it].loop & bit) include(*it);
+            }
+            if (current.empty()) continue;
+            std::sort(current.begin(), current.end());
+
+            auto it = index.find(current);
+            uint32_t target;
+            if (it != index.end())
+                target = it->second;
+            else
+            {
+                if (sets.size() >= GLOB_MAX_STATES)
+                {
+                    automaton_.clear();
+                    return false;
+                }
+                target = automaton_.add(output(current));
+                index[current] = target;
+                sets.push_back(current);
+            }
+            automaton_.link(state, symbol, target);
+        }
+    }
+
+    automaton_.minimize();
+    return true;
+}
+
+uint8_t GlobRules::match( const std::string &host ) const
+{
+    return automaton_.match(host);
+}
+
+uint8_t GlobRules::match( const uint8_t *qname, size_t size ) const
+{
+    return automaton_.match(qname, size);
+}
+
+const Automaton &GlobRules::automaton() const
+{
+    return automaton_;
+}
+
+void GlobRules::clear()
+{
+    patterns_.clear();
+    automaton_.clear();
+}
+
+}
@@ -0,0 +1,49 @@
+#ifndef DNSB_GLOB_HH
+#define DNSB_GLOB_HH
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include "automaton.hh"
+
+namespace dnsblocker {
+
+
+#define GLOB_MAX_STATES   200000
+
+
+/*
+ * Rules with asterisks in the middle of the name (e.g. 'ads*.example.com' or
+ * '*-tracker.*.net'), where each asterisk matches any run of characters within
+ * a label. A leading '*.' or '**.' keeps its usual meaning. All patterns are
+ * compiled together into one minimized automaton, so matching a host name
+ * costs a table lookup per character no matter how many patterns there are.
+ */
+class GlobRules
+{
+    public:
+        GlobRules();
+        size_t size() const;
+        size_t memory() const;
+        int add( const std::string &rule, uint8_t verdict, std::string *clean = nullptr );
+        int add( const char *rule, size_t length, uint8_t verdict, std::string *clean = nullptr );
+        int remove( const std::string &rule, uint8_t verdict );
+        bool compile();
+        uint8_t match( const std::string &host ) const;
+        uint8_t match( const uint8_t *qname, size_t size ) const;
+        const Automaton &automaton() const;
+        void clear();
+        static bool isPattern( const char *rule, size_t length );
+        static bool isPattern( const std::string &rule );
+
+    private:
+        // verdicts of each pattern, in normal form
+        std::map<std::string, uint8_t> patterns_;
+        Automaton automaton_;
+
+        static int parse( const char *rule, size_t length, std::string &pattern, std::string *clean );
+};
+
+}
+
+#endif // DNSB_GLOB_HH
@@ -0,0 +1,229 @@
+#include "heuristic.hh"
+#include "nodes.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace dnsblocker {
+
+RandomDomainModel::RandomDomainModel() : threshold_(0), minLength_(HEURISTIC_MIN_LENGTH), samples_(0)
+{
+    // the symbols of the trees, except that the dot (which is never inside a label) is the boundary
+    for (int i = 0; i < 256; ++i)
+    {
+        int symbol = (i == '.') ? -1 : charToIndex((char) i);
+        symbols_[i] = (symbol < 0) ? (uint8_t) HEURISTIC_INVALID : (uint8_t) symbol;
+    }
+    memset(costs_, 0, sizeof(costs_));
+}
+
+bool RandomDomainModel::empty() const
+{
+    return samples_ == 0;
+}
+
+uint32_t RandomDomainModel::samples() const
+{
+    return samples_;
+}
+
+// threshold in bits per character
+double RandomDomainModel::threshold() const
+{
+    return (double) threshold_ / HEURISTIC_SCALE;
+}
+
+/*
+ * Mean cost of the transitions of a label (in bits per character), or zero
+ * if the label has characters that are never in random labels.
+ */
+double RandomDomainModel::score( const char *label, size_t length ) const
+{
+    uint32_t total = 0;
+    size_t previous = HEURISTIC_BOUNDARY;
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint8_t symbol = symbols_[(uint8_t) label[i]];
+        if (symbol == HEURISTIC_INVALID) return 0;
+        total += costs_[previous * HEURISTIC_SYMBOLS + symbol];
+        previous = symbol;
+    }
+    total += costs_[previous * HEURISTIC_SYMBOLS + HEURISTIC_BOUNDARY];
+    return (double) total / (double) ((length + 1) * HEURISTIC_SCALE);
+}
+
+// whether the label (in wire format) is 'cloudfront', ignoring case
+static bool heuristic_isCloudFront( const uint8_t *label )
+{
+    static const char *NAME = "cloudfront";
+    if (label[0] != 10) return false;
+    for (size_t i = 0; i < 10; ++i)
+        if ((label[i + 1] | 0x20) != NAME[i]) return false;
+    return true;
+}
+
+/*
+ * Rules used before the models: 'label' is the first label and 'size' the
+ * number of bytes after it.
+ */
+bool RandomDomainModel::guess( const uint8_t *label, size_t length, size_t size ) const
+{
+    // names with more than two labels are only checked in 'cloudfront'
+    const uint8_t *next = label + length;
+    if (*next == 0) return false;
+    if (size > (size_t) *next + 1 && next[*next + 1] != 0)
+    {
+        bool found = false;
+        for (size_t offset = 0; !found && offset < size && next[offset] != 0; offset += (size_t) next[offset] + 1)
+            found = offset + 11 <= size && heuristic_isCloudFront(next + offset);
+        if (!found) return false;
+    }
+
+    // at least two digits or less than 30% of vowels
+    size_t digits = 0, vowels = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        uint8_t c = (uint8_t) (label[i] | 0x20);
+        if (label[i] >= '0' && label[i] <= '9')
+            ++digits;
+        else
+        if (c == 'a' || c == 'e' || c == 'i' || c == 'o' || c == 'u')
+            ++vowels;
+    }
+    return digits > 1 || (float) vowels / (float) length < 0.3F;
+}
+
+bool RandomDomainModel::save( const std::string &path ) const
+{
+    HeuristicHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, HEURISTIC_MAGIC);
+    header.version = HEURISTIC_VERSION;
+    header.order = HEURISTIC_ORDER;
+    header.samples = samples_;
+    header.threshold = threshold_;
+    header.minLength = minLength_;
+
+    FILE *output = fopen(path.c_str(), "wb");
+    if (output == nullptr) return false;
+    bool result = fwrite(&header, sizeof(header), 1, output) == 1 &&
+        fwrite(costs_, sizeof(costs_), 1, output) == 1;
+    result = (fclose(output) == 0) && result;
+    if (!result) ::remove(path.c_str());
+    return result;
+}
+
+bool RandomDomainModel::load( const std::string &path )
+{
+    FILE *input = fopen(path.c_str(), "rb");
+    if (input == nullptr) return false;
+    HeuristicHeader header;
+    uint8_t costs[sizeof(costs_)];
+    bool result = fread(&header, sizeof(header), 1, input) == 1 &&
+        fread(costs, sizeof(costs), 1, input) == 1 &&
+        fgetc(input) == EOF;
+    fclose(input);
+
+    if (!result ||
+        strncmp(header.magic, HEURISTIC_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != HEURISTIC_VERSION ||
+        header.order != HEURISTIC_ORDER ||
+        header.samples == 0)
+        return false;
+
+    memcpy(costs_, costs, sizeof(costs_));
+    threshold_ = header.threshold;
+    minLength_ = header.minLength;
+    samples_ = header.samples;
+    return true;
+}
+
+
+RandomDomainTrainer::RandomDomainTrainer()
+{
+}
+
+size_t RandomDomainTrainer::size() const
+{
+    return labels_.size();
+}
+
+/*
+ * Add the labels of a host name, except the top-level domain. Labels with
+ * characters that are never in random labels are ignored.
+ */
+void RandomDomainTrainer::add( const std::string &name )
+{
+    size_t end = name.rfind('.');
+    if (end == std::string::npos) return;
+
+    std::string label;
+    for (size_t start = 0; start < end;)
+    {
+        size_t next = name.find('.', start);
+        label.assign(name, start, next - start);
+        start = next + 1;
+        if (label.empty() || label.length() > 63) continue;
+
+        bool valid = true;
+        for (auto it = label.begin(); valid && it != label.end(); ++it)
+        {
+            int symbol = (*it == '.') ? -1 : charToIndex(*it);
+            valid = symbol >= 0;
+            if (*it >= 'A' && *it <= 'Z') *it = (char) (*it + 32);
+        }
+        if (valid) labels_.insert(label);
+    }
+}
+
+/*
+ * Estimate the transition probabilities from the labels (with add-half
+ * smoothing, so unseen transitions are expensive but not infinite) and set
+ * the threshold so that HEURISTIC_FALSE_RATE of the long training labels
+ * would be detected as random.
+ */
+bool RandomDomainTrainer::train( RandomDomainModel &model ) const
+{
+    std::vector<uint64_t> counts(HEURISTIC_SYMBOLS * HEURISTIC_SYMBOLS, 0);
+    for (auto it = labels_.begin(); it != labels_.end(); ++it)
+    {
+        size_t previous = HEURISTIC_BOUNDARY;
+        for (auto c = it->begin(); c != it->end(); ++c)
+        {
+            size_t symbol = model.symbols_[(uint8_t) *c];
+            ++counts[previous * HEURISTIC_SYMBOLS + symbol];
+            previous = symbol;
+        }
+        ++counts[previous * HEURISTIC_SYMBOLS + HEURISTIC_BOUNDARY];
+    }
+
+    for (size_t i = 0; i < HEURISTIC_SYMBOLS; ++i)
+    {
+        double total = 0.5 * HEURISTIC_SYMBOLS;
+        for (size_t j = 0; j < HEURISTIC_SYMBOLS; ++j) total += (double) counts[i * HEURISTIC_SYMBOLS + j];
+        for (size_t j = 0; j < HEURISTIC_SYMBOLS; ++j)
+        {
+            double cost = -std::log2(((double) counts[i * HEURISTIC_SYMBOLS + j] + 0.5) / total);
+            cost = std::min(std::round(cost * HEURISTIC_SCALE), 255.0);
+            model.costs_[i * HEURISTIC_SYMBOLS + j] = (uint8_t) cost;
+        }
+    }
+
+    std::vector<double> scores;
+    for (auto it = labels_.begin(); it != labels_.end(); ++it)
+    {
+        if (it->length() >= model.minLength_)
+            scores.push_back(model.score(it->c_str(), it->length()));
+    }
+    if (scores.size() < HEURISTIC_MIN_SAMPLES) return false;
+
+    std::sort(scores.begin(), scores.end());
+    size_t index = (size_t) ((double) (scores.size() - 1) * (1.0 - HEURISTIC_FALSE_RATE));
+    double threshold = std::ceil(scores[index] * HEURISTIC_SCALE);
+    model.threshold_ = (uint16_t) std::min(threshold, 255.0);
+    model.samples_ = (uint32_t) labels_.size();
+    return true;
+}
+
+}
@@ -0,0 +1,122 @@
+#ifndef DNSB_HEURISTIC_HH
+#define DNSB_HEURISTIC_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+namespace dnsblocker {
+
+
+#define HEURISTIC_MAGIC          "DNSBHRM"
+#define HEURISTIC_VERSION        1
+#define HEURISTIC_ORDER          0x01020304
+#define HEURISTIC_SYMBOLS        38    // 26 letters, 10 digits, dash and the label boundary
+#define HEURISTIC_BOUNDARY       37    // symbol before the first and after the last character
+#define HEURISTIC_INVALID        0xFF  // characters that are never in random labels
+#define HEURISTIC_SCALE          16    // costs are stored in 1/16 of a bit
+#define HEURISTIC_MIN_LENGTH     10    // shorter labels are never random
+#define HEURISTIC_MIN_SAMPLES    100   // labels required to train a model
+#define HEURISTIC_FALSE_RATE     0.001 // fraction of the training labels above the threshold
+
+
+struct HeuristicHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t order;      // HEURISTIC_ORDER in the byte order of the writer
+    uint32_t samples;    // distinct labels used to train the model
+    uint16_t threshold;  // mean cost per transition above which a label is random
+    uint16_t minLength;  // shorter labels are never random
+};
+
+
+/*
+ * Detector of random domains (used by some tracking and advertising APIs).
+ * The first label of the name (skipping 'www') is scored by a character
+ * bigram model: each transition costs -log2 P(next | previous), so the mean
+ * cost of a label is its cross-entropy in bits per character, and labels
+ * well above the entropy of the names used to train the model are random.
+ * The model is a table of 38 x 38 costs (1.4 KiB) trained offline by
+ * 'dnsblocker-optimize -t'; scoring takes one lookup per character and
+ * allocates nothing.
+ *
+ * Without a model, the fixed rules of older versions are used: long labels of
+ * names with at most two labels (or in 'cloudfront') with several digits or
+ * few vowels.
+ */
+class RandomDomainModel
+{
+    public:
+        RandomDomainModel();
+        bool load( const std::string &path );
+        bool save( const std::string &path ) const;
+        bool empty() const;
+        uint32_t samples() const;
+        double threshold() const;
+        double score( const char *label, size_t length ) const;
+
+        // whether the name in DNS wire format looks random
+        inline bool isRandom( const uint8_t *qname, size_t size ) const
+        {
+            if (size == 0) return false;
+            const uint8_t *label = qname + 1;
+            size_t length = qname[0];
+            if (length == 3 && size > 4 && (label[0] | 0x20) == 'w' && (label[1] | 0x20) == 'w' &&
+                (label[2] | 0x20) == 'w')
+            {
+                label += 4;
+                length = label[-1];
+                size -= 4;
+            }
+            // compression pointers (0xC0) are never in the first label
+            if (length < minLength_ || length > 63 || length + 1 >= size) return false;
+            if (samples_ == 0) return guess(label, length, size - length - 1);
+
+            uint32_t total = 0;
+            size_t previous = HEURISTIC_BOUNDARY;
+            for (size_t i = 0; i < length; ++i)
+            {
+                uint8_t symbol = symbols_[label[i]];
+                if (symbol == HEURISTIC_INVALID) return false;
+                total += costs_[previous * HEURISTIC_SYMBOLS + symbol];
+                previous = symbol;
+            }
+            total += costs_[previous * HEURISTIC_SYMBOLS + HEURISTIC_BOUNDARY];
+            return total > (uint32_t) threshold_ * (uint32_t) (length + 1);
+        }
+
+    private:
+        uint8_t symbols_[256];
+        uint8_t costs_[HEURISTIC_SYMBOLS * HEURISTIC_SYMBOLS];
+        uint16_t threshold_;
+        uint16_t minLength_;
+        uint32_t samples_;
+
+        bool guess( const uint8_t *label, size_t length, size_t size ) const;
+
+        friend class RandomDomainTrainer;
+};
+
+
+/*
+ * Offline trainer of 'RandomDomainModel'. Feed it the labels of names known
+ * to be legitimate (e.g. from cache dumps and query logs); each distinct label
+ * counts once, so popular names don't dominate the model.
+ */
+class RandomDomainTrainer
+{
+    public:
+        RandomDomainTrainer();
+        void add( const std::string &name );
+        size_t size() const;
+        bool train( RandomDomainModel &model ) const;
+
+    private:
+        std::unordered_set<std::string> labels_;
+};
+
+}
+
+#endif // DNSB_HEURISTIC_HH
@@ -0,0 +1,141 @@
+#include "keyword.hh"
+#include "nodes.hh"
+
+namespace dnsblocker {
+
+KeywordRules::KeywordRules()
+{
+}
+
+size_t KeywordRules::size() const
+{
+    return keywords_.size();
+}
+
+size_t KeywordRules::memory() const
+{
+    size_t total = automaton_.memory() + sizeof(KeywordRules);
+    for (auto it = keywords_.begin(); it != keywords_.end(); ++it) total += it->capacity() + 48;
+    return total;
+}
+
+/*
+ * Add a keyword (lowercased, without leading and trailing whitespaces). The
+ * automaton is only updated by 'compile'.
+ */
+int KeywordRules::add( const std::string &keyword, std::string *clean )
+{
+    size_t start = 0;
+    while (start < keyword.length() && (keyword[start] == ' ' || keyword[start] == '\t')) ++start;
+    size_t end = keyword.length();
+    while (end > start && (keyword[end - 1] == ' ' || keyword[end - 1] == '\t')) --end;
+    std::string temp = keyword.substr(start, end - start);
+    if (clean != nullptr) *clean = temp;
+
+    if (temp.empty() || temp.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+    for (auto it = temp.begin(); it != temp.end(); ++it)
+    {
+        if (charToIndex(*it) < 0) return DNSBERR_INVALID_RULE;
+        if (*it >= 'A' && *it <= 'Z') *it = (char) (*it + 32);
+    }
+    if (!keywords_.insert(temp).second) return DNSBERR_DUPLICATED_RULE;
+    return DNSBERR_OK;
+}
+
+/*
+ * Build the automaton of the current keywords. The keywords are reversed (host
+ * names are fed from the last character) and inserted into a trie; failure
+ * links, computed breadth first, complete the missing transitions of each
+ * state with the ones of its longest proper suffix in the trie. Accepting
+ * states loop to themselves, since one keyword is enough to block the name.
+ */
+void KeywordRules::compile()
+{
+    automaton_.clear();
+    if (keywords_.empty()) return;
+
+    // the dead state is never reached, but keeps the numbering of 'Automaton'
+    std::vector<uint32_t> transitions(2 * NODE_SLOTS, AUTOMATON_DEAD);
+    std::vector<uint8_t> outputs(2, 0);
+    for (auto it = keywords_.begin(); it != keywords_.end(); ++it)
+    {
+        uint32_t state = AUTOMATON_START;
+        // stop early if a shorter keyword already matches
+        for (size_t i = it->length(); i > 0 && outputs[state] == 0; --i)
+        {
+            size_t slot = (size_t) state * NODE_SLOTS + (size_t) charToIndex((*it)[i - 1]);
+            if (transitions[slot] == AUTOMATON_DEAD)
+            {
+                transitions[slot] = (uint32_t) outputs.size();
+                outputs.push_back(0);
+                transitions.resize(transitions.size() + NODE_SLOTS, AUTOMATON_DEAD);
+            }
+            state = transitions[slot];
+        }
+        outputs[state] = VERDICT_DENY;
+    }
+
+    // failure links, breadth first, so the failure state of each state is already complete
+    std::vector<uint32_t> failures(outputs.size(), AUTOMATON_START);
+    std::vector<uint32_t> queue;
+    for (size_t i = 0; i < NODE_SLOTS; ++i)
+    {
+        uint32_t &target = transitions[AUTOMATON_START * NODE_SLOTS + i];
+        if (target == AUTOMATON_DEAD)
+            target = AUTOMATON_START;
+        else
+            queue.push_back(target);
+    }
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        uint32_t state = queue[i];
+        uint32_t failure = failures[state];
+        outputs[state] = (uint8_t) (outputs[state] | outputs[failure]);
+        for (size_t j = 0; j < NODE_SLOTS; ++j)
+        {
+            uint32_t &target = transitions[(size_t) state * NODE_SLOTS + j];
+            uint32_t fallback = transitions[(size_t) failure * NODE_SLOTS + j];
+            if (outputs[state] != 0)
+                target = state;
+            else
+            if (target == AUTOMATON_DEAD)
+                target = fallback;
+            else
+            {
+                failures[target] = fallback;
+                queue.push_back(target);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < outputs.size(); ++i) automaton_.add(outputs[i]);
+    for (size_t i = AUTOMATON_START; i < outputs.size(); ++i)
+    {
+        for (int j = 0; j < NODE_SLOTS; ++j)
+            automaton_.link((uint32_t) i, j, transitions[i * NODE_SLOTS + (size_t) j]);
+    }
+    automaton_.minimize();
+}
+
+uint8_t KeywordRules::match( const std::string &host ) const
+{
+    return automaton_.match(host);
+}
+
+uint8_t KeywordRules::match( const uint8_t *qname, size_t size ) const
+{
+    return automaton_.match(qname, size);
+}
+
+const Automaton &KeywordRules::automaton() const
+{
+    return automaton_;
+}
+
+void KeywordRules::clear()
+{
+    keywords_.clear();
+    automaton_.clear();
+}
+
+}
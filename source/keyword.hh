@@ -0,0 +1,40 @@
+#ifndef DNSB_KEYWORD_HH
+#define DNSB_KEYWORD_HH
+
+#include <stdint.h>
+#include <string>
+#include <set>
+#include "automaton.hh"
+
+namespace dnsblocker {
+
+
+/*
+ * Tokens (e.g. 'doubleclick' or 'telemetry') that block any host name
+ * containing them, no matter where. The keywords are compiled into an
+ * Aho-Corasick automaton whose accepting states are absorbing, so a host name
+ * is scanned once, with a table lookup per character, no matter how many
+ * keywords there are.
+ */
+class KeywordRules
+{
+    public:
+        KeywordRules();
+        size_t size() const;
+        size_t memory() const;
+        int add( const std::string &keyword, std::string *clean = nullptr );
+        void compile();
+        uint8_t match( const std::string &host ) const;
+        uint8_t match( const uint8_t *qname, size_t size ) const;
+        const Automaton &automaton() const;
+        void clear();
+
+    private:
+        // keywords in normal form
+        std::set<std::string> keywords_;
+        Automaton automaton_;
+};
+
+}
+
+#endif // DNSB_KEYWORD_HH
@@ -41,6 +41,7 @@ static struct
     Processor *processor = nullptr;
     std::string logPath;
     std::string dumpPath;
+    std::string unusedPath;
     std::string configFileName;
     Configuration config;
 } context;
@@ -133,6 +134,10 @@ void main_parseArguments(
         context.dumpPath = main_realPath(argv[2]);
         context.dumpPath += PATH_SEPARATOR;
         context.dumpPath += LOG_CACHE_DUMP;
+
+        context.unusedPath = main_realPath(argv[2]);
+        context.unusedPath += PATH_SEPARATOR;
+        context.unusedPath += LOG_UNUSED_RULES;
     }
 
     if (context.configFileName.empty())
@@ -209,6 +214,7 @@ void main_prepare()
     in.close();
 
     context.config.dump_path_ = context.dumpPath;
+    context.config.unused_path_ = context.unusedPath;
     if (context.config.cache.limit <= 0) context.config.cache.limit = DNS_CACHE_LIMIT;
     if (context.config.cache.limit <= 0) context.config.cache.ttl = DNS_CACHE_TTL;
 
@@ -229,6 +235,23 @@ void main_prepare()
         else
             ++it;
     }
+    for (auto cit = context.config.categories.begin(); cit != context.config.categories.end(); ++cit)
+    {
+        for (auto it = cit->lists.begin(); it != cit->lists.end();)
+        {
+            *it = main_realPath(*it);
+            if (it->empty())
+                it = cit->lists.erase(it);
+            else
+                ++it;
+        }
+    }
+    if (!context.config.heuristics_model.empty())
+    {
+        // keep the name if the file doesn't exist, so the error shows it
+        std::string path = main_realPath(context.config.heuristics_model);
+        if (!path.empty()) context.config.heuristics_model = path;
+    }
     if (context.config.blacklist.empty())
     {
         LOG_MESSAGE("No valid blacklist specified\n");
@@ -274,6 +297,12 @@ void main_prepare()
         for (auto it = context.config.whitelist.begin() + 1; it != context.config.whitelist.end(); ++it)
             LOG_MESSAGE("               %s\n", it->c_str());
     }
+    for (auto &category : context.config.categories)
+    {
+        LOG_MESSAGE("     Category: %s%s\n", category.name.c_str(), (category.disabled()) ? " (disabled)" : "");
+        for (auto &list : category.lists)
+            LOG_MESSAGE("               %s\n", list.c_str());
+    }
     LOG_MESSAGE(" External DNS: ");
     for (auto &dns : context.config.external_dns)
         LOG_MESSAGE("%s (%s) ", dns.address.c_str(), dns.name.c_str());
@@ -2,6 +2,21 @@
 #include <cstring>
 #include <fstream>
 #include "log.hh"
+#include "defs.hh"
+
+#ifdef __WINDOWS__
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NODE_USE_SSE2
+#endif
 
 
 int charToIndex( char c )
@@ -28,6 +43,101 @@ char indexToChar( int index )
     return '?';
 }
 
+/*
+ * Lowercase version of each valid host character (letters, digits, dash and
+ * dot), or zero for invalid characters.
+ */
+static const char HOST_CHARS[256] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '-', '.', 0,
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 0, 0, 0, 0, 0, 0,
+    0, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', 0, 0, 0, 0, 0,
+    0, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+    'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', 0, 0, 0, 0, 0,
+};
+
+
+#ifdef NODE_USE_SSE2
+/*
+ * Lowercase 16 characters, setting 'valid' to false if any of them is not a
+ * valid host character. Bytes above 0x7F are negative and fail every range.
+ */
+static inline __m128i normalizeBlock( __m128i value, bool &valid )
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(value, _mm_set1_epi8('A' - 1)),
+        _mm_cmplt_epi8(value, _mm_set1_epi8('Z' + 1)));
+    value = _mm_or_si128(value, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(value, _mm_set1_epi8('a' - 1)),
+        _mm_cmplt_epi8(value, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(value, _mm_set1_epi8('0' - 1)),
+        _mm_cmplt_epi8(value, _mm_set1_epi8('9' + 1)));
+    __m128i symbol = _mm_or_si128(_mm_cmpeq_epi8(value, _mm_set1_epi8('-')),
+        _mm_cmpeq_epi8(value, _mm_set1_epi8('.')));
+    __m128i accepted = _mm_or_si128(_mm_or_si128(letter, digit), symbol);
+    if (_mm_movemask_epi8(accepted) != 0xFFFF) valid = false;
+    return value;
+}
+
+// reverse the 16 bytes (SSE2 has no byte shuffle)
+static inline __m128i reverseBlock( __m128i value )
+{
+    value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+    value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+    value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif
+
+
+/*
+ * Lowercase a host name and check whether every character is valid (see
+ * 'charToIndex'), storing the result in 'output' (which may be null to only
+ * validate), in reverse order if 'reverse' is set. The characters are always
+ * stored, even when the function returns false. 'output' may be the same as
+ * 'input' only if 'reverse' is not set.
+ *
+ * With SSE2, names are processed in blocks of 16 characters; the last block
+ * overlaps the previous one instead of reading past the end of the input.
+ */
+bool normalizeHost( const char *input, size_t length, char *output, bool reverse )
+{
+    bool valid = true;
+
+    #ifdef NODE_USE_SSE2
+    if (length >= 16)
+    {
+        for (size_t i = 0; i < length; i += 16)
+        {
+            if (i + 16 > length) i = length - 16;
+            __m128i value = normalizeBlock(_mm_loadu_si128((const __m128i*) (input + i)), valid);
+            if (output == nullptr) continue;
+            if (reverse)
+                _mm_storeu_si128((__m128i*) (output + length - i - 16), reverseBlock(value));
+            else
+                _mm_storeu_si128((__m128i*) (output + i), value);
+        }
+        return valid;
+    }
+    #endif
+
+    for (size_t i = 0; i < length; ++i)
+    {
+        char c = HOST_CHARS[(uint8_t) input[i]];
+        if (c == 0)
+        {
+            valid = false;
+            c = input[i];
+        }
+        if (output != nullptr) output[(reverse) ? length - i - 1 : i] = c;
+    }
+    return valid;
+}
+
+
 char *prepareHostname( char *host )
 {
     if (host == nullptr) return nullptr;
@@ -35,14 +145,15 @@ char *prepareHostname( char *host )
 
     // remove leading and trailing unused characters
     while (*ptr == ' ' || *ptr == '*') ++ptr;
-    if (*ptr == 0) return nullptr;
-    for (size_t i = strlen(ptr) - 1; ptr[i] == ' '; --i) *ptr = 0;
-    // validate the host characters
-    for (char *p = ptr; *p != 0; ++p)
-        if (charToIndex(*p) < 0) return nullptr;
-    // reverse the symbols
-    for (size_t i = 0, t = strlen(ptr); i < t / 2; i++)
-        std::swap(ptr[i],  ptr[t - i - 1]);
+    size_t length = strlen(ptr);
+    while (length > 0 && ptr[length - 1] == ' ') --length;
+    if (length == 0 || length > NODE_MAX_HOST_LENGTH) return nullptr;
+
+    // validate, lowercase and reverse the host characters
+    char temp[NODE_MAX_HOST_LENGTH];
+    if (!normalizeHost(ptr, length, temp, true)) return nullptr;
+    memcpy(ptr, temp, length);
+    ptr[length] = 0;
 
     if (*ptr == '.') return nullptr;
 
@@ -50,3 +161,89 @@ char *prepareHostname( char *host )
 }
 
 
+bool WireName::read( const uint8_t *data, size_t size )
+{
+    count = 0;
+    length = 0;
+    if (data == nullptr) return false;
+
+    size_t i = 0;
+    while (i < size && data[i] != 0)
+    {
+        // reject compression pointers, extended label types and oversized names
+        if ((data[i] & 0xC0) != 0 || count == NODE_MAX_LABELS) return false;
+        size_t end = i + data[i];
+        if (end >= size || end + 1 >= NODE_MAX_WIRE_SIZE) return false;
+        labels[count++] = data + i;
+        length += data[i] + 1U;
+        // validate the label characters
+        if (!normalizeHost((const char*) data + i + 1, data[i], nullptr, false)) return false;
+        i = end + 1;
+    }
+    if (i >= size || count == 0) return false;
+
+    --length;
+    // callers copy the text form into buffers of NODE_MAX_HOST_LENGTH characters
+    if (length > NODE_MAX_HOST_LENGTH) return false;
+    label = count - 1;
+    offset = labels[label][0];
+    // like 'prepareHostname', refuse names ending with a period
+    return labels[label][offset] != '.';
+}
+
+
+
+
+const void *mapFile( const std::string &path, size_t *size )
+{
+    if (size == nullptr) return nullptr;
+
+    #ifdef __WINDOWS__
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER length;
+    if (!GetFileSizeEx(file, &length) || length.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) return nullptr;
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (data == NULL) return nullptr;
+    *size = (size_t) length.QuadPart;
+    return data;
+
+    #else
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *data = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+    *size = (size_t) info.st_size;
+    return data;
+
+    #endif
+}
+
+void unmapFile( const void *data, size_t size )
+{
+    if (data == nullptr) return;
+    #ifdef __WINDOWS__
+    (void) size;
+    UnmapViewOfFile(data);
+    #else
+    munmap((void*) data, size);
+    #endif
+}
@@ -9,21 +9,114 @@
 #include "log.hh"
 #include <dns-blocker/errors.hh>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 
 #define NODE_TERMINAL          1   // this node is a terminal symbol
 #define NODE_WILDCARD          2   // denote a wildcard
 #define NODE_SLOTS             38  // 26 letters, 10 digits, dash and dot
 #define NODE_MAX_HOST_LENGTH   512
+#define NODE_MAX_WIRE_SIZE     255 // a name in wire format has at most 255 bytes (RFC-1035 2.3.4)
+#define NODE_MAX_LABELS        128 // and so at most 127 labels
 
 
 int charToIndex( char c );
 char indexToChar( int index );
+bool normalizeHost( const char *input, size_t length, char *output, bool reverse );
 char *prepareHostname( char *host );
+const void *mapFile( const std::string &path, size_t *size );
+void unmapFile( const void *data, size_t size );
 
 
 typedef uint32_t NodeIndex;
 
 
+#define VERDICT_ALLOW          1   // the domain is in the whitelist
+#define VERDICT_DENY           2   // the domain is in the blacklist
+#define VERDICT_FORWARD        4   // the domain is resolved by a specific external DNS
+
+// categories of blacklist rules (e.g. ads or malware); category 0 holds the lists without category
+#define VERDICT_CATEGORIES     16
+
+
+/*
+ * Value of the unified rule tree, which holds the whitelist, the blacklist
+ * and the targets of the external DNS servers, so a single walk finds every
+ * rule matching a host name.
+ */
+struct Verdict
+{
+    uint8_t domain;         // verdicts for the domain itself
+    uint8_t subdomains;     // verdicts for its subdomains (wildcard rules)
+    uint8_t upstream[2];    // external DNS used with VERDICT_FORWARD, for the domain and for its subdomains
+    uint16_t categories[2]; // categories of VERDICT_DENY (bit N for category N), for the domain and its subdomains
+
+    Verdict() : domain(0), subdomains(0), upstream{ 0, 0 }, categories{ 0, 0 }
+    {
+    }
+};
+
+
+/*
+ * Host name in DNS wire format (RFC-1035 3.1) read in place, without building
+ * a string. 'next' returns the characters in the order used by the trees (the
+ * same order 'prepareHostname' produces: last character first), lowercased,
+ * and zero after the first character. Compressed names are not supported.
+ */
+struct WireName
+{
+    const uint8_t *labels[NODE_MAX_LABELS]; // length octet of each label
+    int count;
+    int label;     // current label
+    int offset;    // position of the next character in the current label
+    size_t length; // length of the name in text form
+
+    bool read( const uint8_t *data, size_t size );
+
+    inline char next()
+    {
+        if (offset > 0)
+        {
+            char c = (char) labels[label][offset--];
+            return (c >= 'A' && c <= 'Z') ? (char) (c + 32) : c;
+        }
+        if (label == 0) return 0;
+        offset = labels[--label][0];
+        return '.';
+    }
+};
+
+
+#define PROFILE_BUCKETS        16  // rows of the depth and chain histograms
+
+
+/*
+ * Shape of a loaded rule tree, filled by the 'profile' method of 'RadixTree'
+ * and 'SuffixTable' and reported by 'profileReport' (see profile.hh). The
+ * last bucket of each histogram also counts the larger values.
+ */
+struct TreeProfile
+{
+    size_t nodes;                    // nodes (or entries) in use
+    size_t rules;                    // terminal nodes ('**' rules count twice)
+    size_t domains;                  // distinct rule domains
+    size_t characters;               // symbols in the edge labels (nodes of a trie without path compression)
+    size_t keys;                     // characters of the distinct rule domains
+    size_t fanout[NODE_SLOTS + 1];   // nodes by number of children
+    size_t depth[PROFILE_BUCKETS];   // rules by number of labels
+    size_t chains[PROFILE_BUCKETS];  // edges by label length (runs of single-child nodes collapsed into one)
+    size_t memory;                   // bytes used by the structure
+    size_t wasted;                   // bytes allocated but unused (released nodes and holes in the pools)
+
+    TreeProfile()
+    {
+        memset(this, 0, sizeof(TreeProfile));
+    }
+};
+
+
 template<typename T>
 struct Node
 {
@@ -43,7 +136,37 @@ struct Node
 };
 
 
+/*
+ * Node with a 38-bit occupancy bitmap instead of fixed slots. The children of
+ * a node are stored contiguously in the child pool of the tree (starting at
+ * 'children') and the position of a child is the number of bits set before
+ * its slot.
+ */
 template<typename T>
+struct SparseNode
+{
+    uint64_t bitmap;
+    NodeIndex children;
+    uint16_t flags;
+    T value;
+
+    SparseNode() : bitmap(0), children(0), flags(0), value()
+    {
+    }
+};
+
+
+inline int nodePopCount( uint64_t value )
+{
+    #if defined(_MSC_VER)
+    return (int) __popcnt64(value);
+    #else
+    return __builtin_popcountll(value);
+    #endif
+}
+
+
+template<typename T, typename N = Node<T> >
 class Tree
 {
     public:
@@ -54,44 +177,185 @@ class Tree
         uint32_t size() const;
         size_t memory() const;
         int add( const std::string &target, const T &value, std::string *clean = nullptr );
-        const Node<T> *match( const std::string &host ) const;
+        int remove( const std::string &target );
+        const N *match( const std::string &host ) const;
         void clear();
 
     private:
-        Node<T> *root;
-        std::vector< Node<T> > nodes;
+        N *root;
+        std::vector<N> nodes;
+        // nodes released by 'remove'
+        std::vector<NodeIndex> freed;
+        // child arrays and free arrays (indexed by length) of sparse nodes
+        std::vector<NodeIndex> pool;
+        std::vector<NodeIndex> holes[NODE_SLOTS + 1];
+
+        NodeIndex allocate();
+        NodeIndex child( const Node<T> &node, int idx ) const;
+        NodeIndex child( const SparseNode<T> &node, int idx ) const;
+        void attach( Node<T> &node, int idx, NodeIndex target );
+        void attach( SparseNode<T> &node, int idx, NodeIndex target );
+        void detach( Node<T> &node, int idx );
+        void detach( SparseNode<T> &node, int idx );
+        static bool leaf( const Node<T> &node );
+        static bool leaf( const SparseNode<T> &node );
 };
 
 
-template<typename T>
-Tree<T>::Tree()
+template<typename T, typename N>
+Tree<T, N>::Tree()
 {
     clear();
 }
 
 
-template<typename T>
-Tree<T>::~Tree()
+template<typename T, typename N>
+Tree<T, N>::~Tree()
 {
 }
 
 
-template<typename T>
-uint32_t Tree<T>::size() const
+template<typename T, typename N>
+uint32_t Tree<T, N>::size() const
 {
-    return (uint32_t) nodes.size();
+    return (uint32_t) (nodes.size() - freed.size());
 }
 
 
-template<typename T>
-size_t Tree<T>::memory() const
+template<typename T, typename N>
+size_t Tree<T, N>::memory() const
 {
-    return sizeof(Node<T>) * nodes.size() + sizeof(Tree<T>);
+    return sizeof(N) * nodes.size() + sizeof(NodeIndex) * pool.size() + sizeof(Tree<T, N>);
 }
 
 
-template<typename T>
-int Tree<T>::add( const std::string &target, const T &value, std::string *clean )
+template<typename T, typename N>
+NodeIndex Tree<T, N>::child( const Node<T> &node, int idx ) const
+{
+    return node.slots[idx];
+}
+
+
+template<typename T, typename N>
+NodeIndex Tree<T, N>::child( const SparseNode<T> &node, int idx ) const
+{
+    uint64_t bit = (uint64_t) 1 << idx;
+    if ((node.bitmap & bit) == 0) return 0;
+    return pool[node.children + (NodeIndex) nodePopCount(node.bitmap & (bit - 1))];
+}
+
+
+template<typename T, typename N>
+void Tree<T, N>::attach( Node<T> &node, int idx, NodeIndex target )
+{
+    node.slots[idx] = target;
+}
+
+
+template<typename T, typename N>
+void Tree<T, N>::attach( SparseNode<T> &node, int idx, NodeIndex target )
+{
+    uint64_t bit = (uint64_t) 1 << idx;
+    size_t count = (size_t) nodePopCount(node.bitmap);
+    size_t rank = (size_t) nodePopCount(node.bitmap & (bit - 1));
+
+    // move the child array to a free area with one more entry
+    NodeIndex offset;
+    if (!holes[count + 1].empty())
+    {
+        offset = holes[count + 1].back();
+        holes[count + 1].pop_back();
+    }
+    else
+    {
+        offset = (NodeIndex) pool.size();
+        pool.resize(pool.size() + count + 1);
+    }
+    NodeIndex *from = pool.data() + node.children;
+    NodeIndex *to = pool.data() + offset;
+    for (size_t i = 0; i < rank; ++i) to[i] = from[i];
+    to[rank] = target;
+    for (size_t i = rank; i < count; ++i) to[i + 1] = from[i];
+    if (count > 0) holes[count].push_back(node.children);
+
+    node.children = offset;
+    node.bitmap |= bit;
+}
+
+
+template<typename T, typename N>
+void Tree<T, N>::detach( Node<T> &node, int idx )
+{
+    node.slots[idx] = 0;
+}
+
+
+template<typename T, typename N>
+void Tree<T, N>::detach( SparseNode<T> &node, int idx )
+{
+    uint64_t bit = (uint64_t) 1 << idx;
+    if ((node.bitmap & bit) == 0) return;
+    size_t count = (size_t) nodePopCount(node.bitmap);
+    size_t rank = (size_t) nodePopCount(node.bitmap & (bit - 1));
+
+    // move the child array to a free area with one less entry
+    NodeIndex offset = 0;
+    if (count > 1)
+    {
+        if (!holes[count - 1].empty())
+        {
+            offset = holes[count - 1].back();
+            holes[count - 1].pop_back();
+        }
+        else
+        {
+            offset = (NodeIndex) pool.size();
+            pool.resize(pool.size() + count - 1);
+        }
+        NodeIndex *from = pool.data() + node.children;
+        NodeIndex *to = pool.data() + offset;
+        for (size_t i = 0; i < rank; ++i) to[i] = from[i];
+        for (size_t i = rank + 1; i < count; ++i) to[i - 1] = from[i];
+    }
+    holes[count].push_back(node.children);
+
+    node.children = offset;
+    node.bitmap &= ~bit;
+}
+
+
+template<typename T, typename N>
+bool Tree<T, N>::leaf( const Node<T> &node )
+{
+    for (size_t i = 0; i < NODE_SLOTS; ++i)
+        if (node.slots[i] != 0) return false;
+    return true;
+}
+
+
+template<typename T, typename N>
+bool Tree<T, N>::leaf( const SparseNode<T> &node )
+{
+    return node.bitmap == 0;
+}
+
+
+template<typename T, typename N>
+NodeIndex Tree<T, N>::allocate()
+{
+    if (!freed.empty())
+    {
+        NodeIndex index = freed.back();
+        freed.pop_back();
+        return index;
+    }
+    nodes.resize(nodes.size() + 1);
+    return (NodeIndex) (nodes.size() - 1);
+}
+
+
+template<typename T, typename N>
+int Tree<T, N>::add( const std::string &target, const T &value, std::string *clean )
 {
     if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
 
@@ -109,16 +373,22 @@ int Tree<T>::add( const std::string &target, const T &value, std::string *clean
     if (clean != nullptr) *clean = temp;
 
     bool isWildcard = false;
+    int duplicated = DNSBERR_DUPLICATED_RULE;
     // '*' and '**' must precede a period
     if (temp[0] == '*')
     {
         isWildcard = true;
 
-        // if we have a 'double star', add the domain itself
+        // if we have a 'double star', add the domain itself (the rule is only
+        // duplicated if both the domain and the wildcard already exist)
         if (temp[1] == '*' && temp[2] == '.')
         {
             int result = add(temp + 3, value);
-            if (result != DNSBERR_OK) return result;
+            if (result == DNSBERR_OK)
+                duplicated = DNSBERR_OK;
+            else
+            if (result != DNSBERR_DUPLICATED_RULE)
+                return result;
         }
         else
         if (temp[1] != '.')
@@ -135,20 +405,20 @@ int Tree<T>::add( const std::string &target, const T &value, std::string *clean
     for (;*ptr != 0; ++ptr)
     {
         int idx = charToIndex(*ptr);
-        if (CURRENT.slots[idx] == 0)
+        NodeIndex next = child(CURRENT, idx);
+        if (next == 0)
         {
-            nodes.resize(nodes.size() + 1);
-            NodeIndex temp = (NodeIndex) (nodes.size() - 1);
-            CURRENT.slots[idx] = temp;
+            NodeIndex temp = allocate();
+            attach(CURRENT, idx, temp);
             current = temp;
         }
         else
         {
-            current = CURRENT.slots[idx];
-            if (CURRENT.flags & NODE_WILDCARD) return DNSBERR_DUPLICATED_RULE;
+            current = next;
+            if (CURRENT.flags & NODE_WILDCARD) return duplicated;
         }
     }
-    if (CURRENT.flags & NODE_TERMINAL) return DNSBERR_DUPLICATED_RULE;
+    if (CURRENT.flags & NODE_TERMINAL) return duplicated;
     CURRENT.flags |= NODE_TERMINAL;
     CURRENT.value = value;
     if (isWildcard) CURRENT.flags |= NODE_WILDCARD;
@@ -159,8 +429,81 @@ int Tree<T>::add( const std::string &target, const T &value, std::string *clean
 }
 
 
-template<typename T>
-const Node<T> *Tree<T>::match( const std::string &target ) const
+/*
+ * Remove a rule added with 'add'. A '**' rule removes both the domain and the
+ * wildcard. Nodes left without rules and children are released and reused by
+ * later insertions. Rules that were ignored by 'add' because a wildcard already
+ * covered them are not restored.
+ */
+template<typename T, typename N>
+int Tree<T, N>::remove( const std::string &target )
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    uint32_t flags = NODE_TERMINAL;
+    if (temp[0] == '*')
+    {
+        flags |= NODE_WILDCARD;
+
+        // a 'double star' removes the domain and the wildcard
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            int domain = remove(temp + 3);
+            int wildcard = remove(temp + 1);
+            return (domain == DNSBERR_OK) ? domain : wildcard;
+        }
+        else
+        if (temp[1] != '.')
+            return DNSBERR_INVALID_RULE;
+    }
+
+    // preprocess the host name
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return DNSBERR_INVALID_ARGUMENT;
+
+    // find the node, keeping the path to it
+    NodeIndex path[NODE_MAX_HOST_LENGTH + 1];
+    int symbols[NODE_MAX_HOST_LENGTH + 1];
+    size_t depth = 0;
+    path[0] = 0;
+    for (;*ptr != 0; ++ptr)
+    {
+        symbols[depth] = charToIndex(*ptr);
+        NodeIndex next = child(nodes[path[depth]], symbols[depth]);
+        if (next == 0) return DNSBERR_MISSING_RULE;
+        path[++depth] = next;
+    }
+
+    N &node = nodes[path[depth]];
+    if ((node.flags & flags) != flags) return DNSBERR_MISSING_RULE;
+    node.flags = (decltype(node.flags)) (node.flags & ~flags);
+
+    // release the nodes that became useless
+    for (; depth > 0 && nodes[path[depth]].flags == 0 && leaf(nodes[path[depth]]); --depth)
+    {
+        detach(nodes[path[depth - 1]], symbols[depth - 1]);
+        nodes[path[depth]] = N();
+        freed.push_back(path[depth]);
+    }
+
+    return DNSBERR_OK;
+}
+
+
+template<typename T, typename N>
+const N *Tree<T, N>::match( const std::string &target ) const
 {
     if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return nullptr;
 
@@ -177,7 +520,7 @@ const Node<T> *Tree<T>::match( const std::string &target ) const
     for (;*ptr != 0; ++ptr)
     {
         int idx = charToIndex(*ptr);
-        current = CURRENT.slots[idx];
+        current = child(CURRENT, idx);
         if (current == 0) return nullptr;
         if (CURRENT.flags & NODE_WILDCARD) return &CURRENT;
     }
@@ -191,12 +534,15 @@ const Node<T> *Tree<T>::match( const std::string &target ) const
 }
 
 
-template<typename T>
-void Tree<T>::clear()
+template<typename T, typename N>
+void Tree<T, N>::clear()
 {
     nodes.clear();
     nodes.resize(1);
     root = &nodes.front();
+    freed.clear();
+    pool.clear();
+    for (size_t i = 0; i <= NODE_SLOTS; ++i) holes[i].clear();
 }
 
 
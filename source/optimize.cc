@@ -1,29 +1,214 @@
 #include "nodes.hh"
+#include "radix.hh"
+#include "optimizer.hh"
+#include "profile.hh"
+#include "scanner.hh"
+#include "heuristic.hh"
+#include <fstream>
+#include <sstream>
 
 
 int main_usage()
 {
-    std::cerr << "Usage: optimize <target blacklist> <base blacklist>" << std::endl;
-    std::cerr << "       optimize <target blacklist>" << std::endl;
+    std::cerr << "Usage: dnsblocker-optimize <target blacklist> <base blacklist>" << std::endl;
+    std::cerr << "       dnsblocker-optimize <target blacklist>" << std::endl;
+    std::cerr << "       dnsblocker-optimize -p <blacklist> [ <blacklist> ... ]" << std::endl;
+    std::cerr << "       dnsblocker-optimize -c <output image> <blacklist> [ <blacklist> ... ]" << std::endl;
+    std::cerr << "       dnsblocker-optimize -s <blacklist or image> [ <blacklist> ... ]" << std::endl;
+    std::cerr << "       dnsblocker-optimize -t <output model> <cache dump or log> [ <cache dump or log> ... ]" << std::endl;
     return 1;
 }
 
-void loadRules( const std::string &fileName, std::vector<std::string> &values )
+// reads plain lists, hosts files and adblock lists like 'dnsblocker' does
+bool loadRules( const std::string &fileName, std::vector<std::string> &values )
 {
-    std::ifstream rules(fileName.c_str());
-    if (!rules.good()) return;
-    std::string line;
+    return scanRuleFile(fileName, [&values]( const char *rule, size_t length, uint32_t )
+    {
+        values.push_back(std::string(rule, length));
+    });
+}
+
+
+/*
+ * Load the given lists (starting at 'argv[first]') and remove the redundant
+ * rules. Prints the number of nodes and the memory usage of the original and
+ * of the optimized rules.
+ */
+bool optimizeRules( int argc, char **argv, int first, std::vector<std::string> &output )
+{
+    RuleOptimizer optimizer;
+    RadixTree<uint8_t> original;
+    std::vector<std::string> entries;
+
+    for (int i = first; i < argc; ++i)
+    {
+        std::cerr << "-- Loading '" << argv[i] << "'" << std::endl;
+        if (!loadRules(argv[i], entries))
+        {
+            std::cerr << "ERROR: Unable to read '" << argv[i] << "'" << std::endl;
+            return false;
+        }
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+        {
+            optimizer.add(*it);
+            original.add(*it, 0);
+        }
+        entries.clear();
+    }
+
+    size_t removed = optimizer.optimize();
+    RadixTree<uint8_t> optimized;
+    std::string rule;
+    for (size_t i = 0; i < optimizer.size(); ++i)
+    {
+        if (!optimizer.rule(i, rule)) continue;
+        output.push_back(rule);
+        optimized.add(rule, 0);
+    }
+
+    std::cerr << "-- Removed " << removed << " redundant rules, kept " << output.size() << std::endl;
+    std::cerr << "   Nodes: " << original.size() << " -> " << optimized.size() << std::endl;
+    std::cerr << "   Memory: " << original.memory() << " -> " << optimized.memory() << " bytes" << std::endl;
+    return true;
+}
+
+
+/*
+ * Print the given lists without redundant rules.
+ */
+int main_prune( int argc, char **argv )
+{
+    std::vector<std::string> rules;
+    if (!optimizeRules(argc, argv, 2, rules)) return 1;
+    for (auto it = rules.begin(); it != rules.end(); ++it)
+        std::cout << *it << std::endl;
+    return 0;
+}
+
+
+/*
+ * Compile one or more rule lists into a binary image that 'dnsblocker' can
+ * map and use without parsing anything.
+ */
+int main_compile( int argc, char **argv )
+{
+    RadixTree<Verdict> tree;
+    std::vector<std::string> entries;
+    if (!optimizeRules(argc, argv, 3, entries)) return 1;
+
+    // images are blacklists
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+        tree.mark(*it, VERDICT_DENY);
 
-    while (!rules.eof())
+    if (!tree.save(argv[2]))
     {
-        std::getline(rules, line);
-        values.push_back(line);
+        std::cerr << "ERROR: Unable to write '" << argv[2] << "'" << std::endl;
+        return 1;
     }
+    std::cerr << "-- Wrote " << tree.size() << " nodes (" << tree.memory() << " bytes) to '"
+        << argv[2] << "'" << std::endl;
+    return 0;
+}
+
+
+/*
+ * Load the given lists (the first one may be a compiled image) like
+ * 'dnsblocker' does and print the shape of the resulting tree.
+ */
+int main_profile( int argc, char **argv )
+{
+    RadixTree<Verdict> tree;
+    std::vector<std::string> entries;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::cerr << "-- Loading '" << argv[i] << "'" << std::endl;
+        if (i == 2 && RadixTree<Verdict>::isImage(argv[i]))
+        {
+            if (tree.load(argv[i])) continue;
+            std::cerr << "ERROR: Unable to load the image '" << argv[i] << "'" << std::endl;
+            return 1;
+        }
+        if (!loadRules(argv[i], entries))
+        {
+            std::cerr << "ERROR: Unable to read '" << argv[i] << "'" << std::endl;
+            return 1;
+        }
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+            tree.mark(*it, VERDICT_DENY);
+        entries.clear();
+    }
+
+    TreeProfile profile;
+    tree.profile(profile);
+    std::cout << profileReport<Verdict>(profile, PROFILE_RADIX);
+    return 0;
+}
+
+
+/*
+ * Train the model of the heuristics with the names in cache dumps, query logs
+ * or lists of legitimate domains: the name is the last word of each line, and
+ * blocked queries ('DE' in logs) are ignored.
+ */
+int main_train( int argc, char **argv )
+{
+    dnsblocker::RandomDomainTrainer trainer;
+    std::string line, word, name;
+
+    for (int i = 3; i < argc; ++i)
+    {
+        std::cerr << "-- Loading '" << argv[i] << "'" << std::endl;
+        std::ifstream input(argv[i]);
+        if (!input.good())
+        {
+            std::cerr << "ERROR: Unable to read '" << argv[i] << "'" << std::endl;
+            return 1;
+        }
+        while (std::getline(input, line))
+        {
+            std::istringstream words(line);
+            bool blocked = false;
+            name.clear();
+            while (words >> word)
+            {
+                if (word == "DE") blocked = true;
+                name.swap(word);
+            }
+            if (blocked) continue;
+            // drop the color of the logs and the trailing dot
+            name.erase(std::min(name.find('\033'), name.length()));
+            if (!name.empty() && name.back() == '.') name.pop_back();
+            // ignore addresses
+            if (name.find_first_not_of("0123456789.") == std::string::npos) continue;
+            trainer.add(name);
+        }
+    }
+
+    dnsblocker::RandomDomainModel model;
+    if (!trainer.train(model))
+    {
+        std::cerr << "ERROR: At least " << HEURISTIC_MIN_SAMPLES << " labels with " << HEURISTIC_MIN_LENGTH
+            << " or more characters are required" << std::endl;
+        return 1;
+    }
+    if (!model.save(argv[2]))
+    {
+        std::cerr << "ERROR: Unable to write '" << argv[2] << "'" << std::endl;
+        return 1;
+    }
+    std::cerr << "-- Trained with " << trainer.size() << " labels (threshold of " << model.threshold()
+        << " bits per character) to '" << argv[2] << "'" << std::endl;
+    return 0;
 }
 
 
 int main( int argc, char **argv )
 {
+    if (argc >= 4 && strcmp(argv[1], "-c") == 0) return main_compile(argc, argv);
+    if (argc >= 3 && strcmp(argv[1], "-p") == 0) return main_prune(argc, argv);
+    if (argc >= 3 && strcmp(argv[1], "-s") == 0) return main_profile(argc, argv);
+    if (argc >= 4 && strcmp(argv[1], "-t") == 0) return main_train(argc, argv);
     if (argc < 2 || argc > 3) return main_usage();
 
     Tree<uint8_t> blacklist;
@@ -44,4 +229,4 @@ int main( int argc, char **argv )
         if (blacklist.add(*it, 0) == DNSBERR_OK)
             std::cout << *it << std::endl;
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,141 @@
+#include "optimizer.hh"
+#include "nodes.hh"
+
+
+#define OPTIMIZER_INVALID   0x80000000U
+
+
+RuleOptimizer::RuleOptimizer()
+{
+}
+
+
+void RuleOptimizer::add( const std::string &rule )
+{
+    add(rule.c_str(), rule.length());
+}
+
+
+void RuleOptimizer::add( const char *rule, size_t length )
+{
+    // keep the first word, ignoring comments
+    size_t start = 0;
+    while (start < length && (rule[start] == ' ' || rule[start] == '\t' || rule[start] == '\r')) ++start;
+    size_t end = start;
+    while (end < length && rule[end] != ' ' && rule[end] != '\t' && rule[end] != '\r' && rule[end] != '#') ++end;
+    std::string name(rule + start, end - start);
+
+    uint16_t flags = NODE_TERMINAL;
+    size_t prefix = 0;
+    if (name.compare(0, 3, "**.") == 0)
+    {
+        flags = NODE_TERMINAL | NODE_WILDCARD;
+        prefix = 3;
+    }
+    else
+    if (name.compare(0, 2, "*.") == 0)
+    {
+        flags = NODE_WILDCARD;
+        prefix = 2;
+    }
+
+    // validate the domain
+    bool valid = name.length() > prefix && name[prefix] != '.' && name.back() != '.' &&
+        normalizeHost(name.c_str() + prefix, name.length() - prefix, nullptr, false);
+    if (!valid)
+    {
+        rules_.push_back(OPTIMIZER_INVALID | (uint32_t) invalid_.size());
+        invalid_.push_back(name);
+        return;
+    }
+    name.erase(0, prefix);
+    normalizeHost(name.c_str(), name.length(), &name[0], false);
+
+    auto it = index_.find(name);
+    if (it == index_.end())
+    {
+        Domain domain;
+        domain.name = name;
+        domain.flags = flags;
+        domain.first = (uint32_t) rules_.size();
+        domain.covered = false;
+        it = index_.insert(std::make_pair(name, (uint32_t) domains_.size())).first;
+        domains_.push_back(domain);
+    }
+    else
+        domains_[it->second].flags = (uint16_t) (domains_[it->second].flags | flags);
+    rules_.push_back(it->second);
+}
+
+
+/*
+ * Mark the domains covered by wildcards of their parent domains. Returns the
+ * number of rules that will be dropped.
+ */
+size_t RuleOptimizer::optimize()
+{
+    size_t kept = 0;
+    for (auto it = domains_.begin(); it != domains_.end(); ++it)
+    {
+        it->covered = false;
+        for (size_t pos = it->name.find('.'); !it->covered && pos != std::string::npos;
+             pos = it->name.find('.', pos + 1))
+        {
+            auto parent = index_.find(it->name.substr(pos + 1));
+            it->covered = parent != index_.end() && (domains_[parent->second].flags & NODE_WILDCARD);
+        }
+        if (!it->covered) ++kept;
+    }
+    // blank lines are not rules
+    size_t blank = 0;
+    for (auto it = invalid_.begin(); it != invalid_.end(); ++it)
+    {
+        if (it->empty())
+            ++blank;
+        else
+            ++kept;
+    }
+    return rules_.size() - blank - kept;
+}
+
+
+/*
+ * Get the rule that replaces the given rule. Returns false if the rule must
+ * be dropped.
+ */
+bool RuleOptimizer::rule( size_t index, std::string &output ) const
+{
+    if (index >= rules_.size()) return false;
+    uint32_t value = rules_[index];
+    if (value & OPTIMIZER_INVALID)
+    {
+        output = invalid_[value & ~OPTIMIZER_INVALID];
+        return !output.empty();
+    }
+
+    const Domain &domain = domains_[value];
+    if (domain.covered || domain.first != index) return false;
+    if (domain.flags == (NODE_TERMINAL | NODE_WILDCARD))
+        output = "**." + domain.name;
+    else
+    if (domain.flags == NODE_WILDCARD)
+        output = "*." + domain.name;
+    else
+        output = domain.name;
+    return true;
+}
+
+
+size_t RuleOptimizer::size() const
+{
+    return rules_.size();
+}
+
+
+void RuleOptimizer::clear()
+{
+    domains_.clear();
+    index_.clear();
+    rules_.clear();
+    invalid_.clear();
+}
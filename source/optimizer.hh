@@ -0,0 +1,50 @@
+#ifndef DNSB_OPTIMIZER_HH
+#define DNSB_OPTIMIZER_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+
+/*
+ * Removes redundant rules from a set of lists, regardless of their order:
+ * rules covered by a wildcard ('a.x.com' and '*.a.x.com' with '*.x.com') are
+ * dropped and a domain listed both alone and as a wildcard ('x.com' and
+ * '*.x.com') becomes a single '**' rule. The optimized rules match exactly the
+ * same host names.
+ *
+ * Rules are added in order with 'add' and, after 'optimize', 'rule' returns
+ * what replaces each of them: the rule in normal form or nothing, if it's
+ * redundant. Rules that can't be parsed are kept as they are, so whoever
+ * loads them can report them.
+ */
+class RuleOptimizer
+{
+    public:
+        RuleOptimizer();
+        void add( const char *rule, size_t length );
+        void add( const std::string &rule );
+        size_t optimize();
+        bool rule( size_t index, std::string &output ) const;
+        size_t size() const;
+        void clear();
+
+    private:
+        struct Domain
+        {
+            std::string name;
+            uint16_t flags;
+            uint32_t first;   // index of the first rule of the domain
+            bool covered;
+        };
+
+        std::vector<Domain> domains_;
+        std::unordered_map<std::string, uint32_t> index_;
+        // domain of each rule, or the rule itself if it couldn't be parsed
+        std::vector<uint32_t> rules_;
+        std::vector<std::string> invalid_;
+};
+
+
+#endif // DNSB_OPTIMIZER_HH
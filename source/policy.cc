@@ -0,0 +1,133 @@
+#include "policy.hh"
+#include "nodes.hh"
+#include <algorithm>
+#include <cstdlib>
+
+namespace dnsblocker {
+
+PolicyTable::PolicyTable()
+{
+}
+
+size_t PolicyTable::size() const
+{
+    return prefixes_.size();
+}
+
+size_t PolicyTable::memory() const
+{
+    return sizeof(uint16_t) * (root_.capacity() + chunks_.capacity()) + sizeof(Prefix) * prefixes_.capacity() +
+        sizeof(PolicyTable);
+}
+
+/*
+ * Parse an IPv4 subnet in CIDR notation ('192.168.0.0/16'). A single address
+ * is a /32 subnet. The host bits of the address are cleared.
+ */
+bool PolicyTable::parse( const std::string &subnet, uint32_t &address, int &length )
+{
+    const char *ptr = subnet.c_str();
+    address = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (*ptr < '0' || *ptr > '9') return false;
+        char *end = nullptr;
+        unsigned long octet = strtoul(ptr, &end, 10);
+        if (octet > 255 || end - ptr > 3) return false;
+        address = (address << 8) | (uint32_t) octet;
+        ptr = end;
+        if (i < 3 && *ptr++ != '.') return false;
+    }
+
+    length = 32;
+    if (*ptr == '/')
+    {
+        ++ptr;
+        if (*ptr < '0' || *ptr > '9') return false;
+        char *end = nullptr;
+        unsigned long value = strtoul(ptr, &end, 10);
+        if (value > 32) return false;
+        length = (int) value;
+        ptr = end;
+    }
+    if (*ptr != 0) return false;
+    if (length < 32) address &= ~(0xFFFFFFFFU >> length);
+    return true;
+}
+
+/*
+ * Map a subnet to a group (1 to POLICY_MAX_GROUPS). The table is only updated
+ * by 'build'.
+ */
+int PolicyTable::add( const std::string &subnet, uint8_t group )
+{
+    Prefix prefix;
+    if (group == 0 || prefixes_.size() >= POLICY_MAX_SUBNETS || !parse(subnet, prefix.address, prefix.length))
+        return DNSBERR_INVALID_ARGUMENT;
+    prefix.group = group;
+    for (auto it = prefixes_.begin(); it != prefixes_.end(); ++it)
+        if (it->address == prefix.address && it->length == prefix.length) return DNSBERR_DUPLICATED_RULE;
+    prefixes_.push_back(prefix);
+    return DNSBERR_OK;
+}
+
+/*
+ * Returns the chunk of an entry, creating it (filled with the group of the
+ * entry) if the entry is a group.
+ */
+uint16_t *PolicyTable::expand( uint16_t &entry )
+{
+    if (entry & POLICY_CHUNK) return chunks_.data() + (size_t) (entry & ~POLICY_CHUNK) * 256;
+
+    // 'entry' may be in 'chunks_', so it's updated before the chunks are moved
+    size_t offset = chunks_.size();
+    uint16_t group = entry;
+    entry = (uint16_t) (POLICY_CHUNK | (offset / 256));
+    chunks_.resize(offset + 256, group);
+    return chunks_.data() + offset;
+}
+
+void PolicyTable::build()
+{
+    root_.clear();
+    chunks_.clear();
+    if (prefixes_.empty()) return;
+
+    std::stable_sort(prefixes_.begin(), prefixes_.end(), []( const Prefix &a, const Prefix &b )
+    {
+        return a.length < b.length;
+    });
+    root_.resize(65536, 0);
+
+    for (auto it = prefixes_.begin(); it != prefixes_.end(); ++it)
+    {
+        // fill the entries covered by the prefix at the level where it ends
+        uint32_t first = it->address >> 16;
+        if (it->length <= 16)
+        {
+            std::fill(root_.begin() + first, root_.begin() + first + (1U << (16 - it->length)), it->group);
+            continue;
+        }
+        uint16_t *level = expand(root_[first]);
+        first = (it->address >> 8) & 0xFF;
+        if (it->length <= 24)
+        {
+            std::fill(level + first, level + first + (1U << (24 - it->length)), it->group);
+            continue;
+        }
+        // 'expand' may move the chunks, so the second level is found again
+        size_t offset = (size_t) (level - chunks_.data()) + first;
+        level = expand(chunks_[offset]);
+        first = it->address & 0xFF;
+        std::fill(level + first, level + first + (1U << (32 - it->length)), it->group);
+    }
+}
+
+void PolicyTable::clear()
+{
+    prefixes_.clear();
+    root_.clear();
+    chunks_.clear();
+}
+
+}
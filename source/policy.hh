@@ -0,0 +1,79 @@
+#ifndef DNSB_POLICY_HH
+#define DNSB_POLICY_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace dnsblocker {
+
+
+#define POLICY_MAX_GROUPS   255
+#define POLICY_MAX_SUBNETS  16000   // each subnet adds at most two chunks
+#define POLICY_CHUNK        0x8000  // the entry is the index of a chunk, not a group
+
+
+// filtering applied to a group of clients
+struct ClientPolicy
+{
+    uint16_t categories;  // categories of blacklist rules applied (bit N for category N)
+    bool filtering;       // whether queries are filtered at all
+    bool heuristics;      // whether random domains are detected (if enabled in the console)
+    int upstream;         // external DNS (see 'DNSCache::addUpstream') or -1 for the default one
+
+    ClientPolicy() : categories(0xFFFF), filtering(true), heuristics(true), upstream(-1)
+    {
+    }
+};
+
+
+/*
+ * Longest-prefix-match table of IPv4 client subnets, laid out like DIR-16-8-8:
+ * the first 16 bits of the address index a table of 65536 entries, and the
+ * entries covered by longer prefixes point to chunks of 256 entries for the
+ * next 8 bits. A lookup reads at most three entries. Prefixes are expanded
+ * into the entries they cover by 'build', shortest first, so longer prefixes
+ * overwrite shorter ones.
+ */
+class PolicyTable
+{
+    public:
+        PolicyTable();
+        int add( const std::string &subnet, uint8_t group );
+        void build();
+        size_t size() const;
+        size_t memory() const;
+        void clear();
+        static bool parse( const std::string &subnet, uint32_t &address, int &length );
+
+        // group of the given address (in host byte order), or zero if no subnet has it
+        inline uint8_t find( uint32_t address ) const
+        {
+            if (root_.empty()) return 0;
+            uint16_t entry = root_[address >> 16];
+            if (entry & POLICY_CHUNK)
+            {
+                entry = chunks_[(size_t) (entry & ~POLICY_CHUNK) * 256 + ((address >> 8) & 0xFF)];
+                if (entry & POLICY_CHUNK) entry = chunks_[(size_t) (entry & ~POLICY_CHUNK) * 256 + (address & 0xFF)];
+            }
+            return (uint8_t) entry;
+        }
+
+    private:
+        struct Prefix
+        {
+            uint32_t address;
+            int length;
+            uint8_t group;
+        };
+
+        std::vector<Prefix> prefixes_;
+        std::vector<uint16_t> root_;
+        std::vector<uint16_t> chunks_;
+
+        uint16_t *expand( uint16_t &entry );
+};
+
+}
+
+#endif // DNSB_POLICY_HH
@@ -1,8 +1,13 @@
 #include "process.hh"
+#include "profile.hh"
 #include "log.hh"
+#include "scanner.hh"
+#include "optimizer.hh"
 #include <stdexcept>
 #include <limits.h>
 #include <chrono>
+#include <algorithm>
+#include <functional>
 
 #ifdef __WINDOWS__
 #include <Windows.h>
@@ -15,8 +20,8 @@
 
 namespace dnsblocker {
 
-Processor::Processor( const Configuration &config ) : config_(config), running_(false), useHeuristics_(false),
-    useFiltering_(true)
+Processor::Processor( const Configuration &config ) : config_(config), rules_(nullptr), epoch_(1), reader_(0),
+    running_(false), useHeuristics_(false), useFiltering_(true), useColors_(false), categories_(1)
 {
     if (config.binding.port() > 65535)
     {
@@ -24,6 +29,18 @@ Processor::Processor( const Configuration &config ) : config_(config), running_(
         throw std::runtime_error("Invalid port number");
     }
     useHeuristics_ = config.use_heuristics();
+    #if !defined(_WIN32) && !defined(_WIN64)
+    useColors_ = isatty(STDIN_FILENO) != 0;
+    #endif
+    if (!config.heuristics_model.empty())
+    {
+        if (heuristics_.load(config.heuristics_model))
+            LOG_MESSAGE("Loaded heuristics model '%s' (%d labels, threshold of %.2f bits per character)\n",
+                config.heuristics_model.c_str(), (int) heuristics_.samples(), heuristics_.threshold());
+        else
+            LOG_MESSAGE("  [!] Unable to load heuristics model '%s', using the built-in rules\n",
+                config.heuristics_model.c_str());
+    }
 
     bindIP_.type = ADDR_TYPE_A;
     bindIP_.ipv4 = UDP::hostToIPv4(config.binding.address);
@@ -51,10 +68,8 @@ Processor::Processor( const Configuration &config ) : config_(config), running_(
         }
         else
         {
-            for (size_t i = 0; i < it->targets.size(); ++i)
-            {
-                cache_->addTarget(it->targets[i], it->address, it->name);
-            }
+            // the targets are added to the rules by 'loadRuleSet'
+            cache_->addUpstream(it->address, it->name);
         }
     }
     if (!found)
@@ -63,8 +78,16 @@ Processor::Processor( const Configuration &config ) : config_(config), running_(
         throw std::runtime_error("Missing default external DNS");
     }
 
-    loadRules(config_.blacklist, blacklist_);
-    loadRules(config_.whitelist, whitelist_);
+    // the lists of the category N + 1 are in 'categories[N]'
+    if (config.categories.size() >= VERDICT_CATEGORIES)
+        LOG_MESSAGE("  [!] Ignoring categories after '%s' (at most %d categories)\n",
+            config.categories[VERDICT_CATEGORIES - 2].name.c_str(), VERDICT_CATEGORIES - 1);
+    for (size_t i = 0; i < config.categories.size() && i + 1 < VERDICT_CATEGORIES; ++i)
+        if (!config.categories[i].disabled()) categories_ |= (uint16_t) (1U << (i + 1));
+
+    loadPolicies();
+
+    rules_ = loadRuleSet();
 }
 
 
@@ -75,6 +98,7 @@ Processor::~Processor()
 	conn_ = nullptr;
     delete cache_;
 	cache_ = nullptr;
+    delete rules_.exchange(nullptr);
 }
 
 
@@ -94,78 +118,620 @@ Job *Processor::pop()
 }
 
 
+static float memoryUnit( size_t bytes, const char **unit )
+{
+    float mem = (float) bytes;
+    *unit = "bytes";
+    if (mem > 1024 * 1024)
+    {
+        mem /= 1024 * 1024;
+        *unit = "MiB";
+    }
+    else
+    if (mem > 1024)
+    {
+        mem /= 1024;
+        *unit = "KiB";
+    }
+    return mem;
+}
+
+
+/*
+ * Build the policies of the client groups and the table of their subnets. The
+ * first policy is used for clients without group.
+ */
+void Processor::loadPolicies()
+{
+    policies_.assign(1, ClientPolicy());
+    if (config_.policies.size() > POLICY_MAX_GROUPS)
+        LOG_MESSAGE("  [!] Ignoring policies after '%s' (at most %d policies)\n",
+            config_.policies[POLICY_MAX_GROUPS - 1].name.c_str(), POLICY_MAX_GROUPS);
+
+    // external DNS servers in the order given to 'addUpstream' (only the ones with targets, so far)
+    std::vector<std::string> upstreams;
+    for (auto it = config_.external_dns.begin(); it != config_.external_dns.end(); ++it)
+        if (!it->targets.empty()) upstreams.push_back(it->name);
+
+    for (size_t i = 0; i < config_.policies.size() && i < POLICY_MAX_GROUPS; ++i)
+    {
+        const Policy &entry = config_.policies[i];
+        ClientPolicy policy;
+        policy.filtering = !entry.disable_filtering();
+        policy.heuristics = !entry.disable_heuristics();
+
+        // the lists without category are named 'blacklist'; every category applies by default
+        if (!entry.categories.empty()) policy.categories = 0;
+        for (auto it = entry.categories.begin(); it != entry.categories.end(); ++it)
+        {
+            int bit = (*it == "blacklist") ? 0 : -1;
+            for (size_t j = 0; bit < 0 && j < config_.categories.size() && j + 1 < VERDICT_CATEGORIES; ++j)
+                if (config_.categories[j].name == *it) bit = (int) j + 1;
+            if (bit < 0)
+            {
+                LOG_MESSAGE("  [!] Unknown category '%s' in policy '%s'\n", it->c_str(), entry.name.c_str());
+                continue;
+            }
+            policy.categories = (uint16_t) (policy.categories | (1U << bit));
+        }
+
+        if (!entry.upstream.empty())
+        {
+            auto dns = config_.external_dns.begin();
+            while (dns != config_.external_dns.end() && dns->name != entry.upstream) ++dns;
+            auto known = std::find(upstreams.begin(), upstreams.end(), entry.upstream);
+            if (dns == config_.external_dns.end())
+                LOG_MESSAGE("  [!] Unknown external DNS '%s' in policy '%s'\n", entry.upstream.c_str(),
+                    entry.name.c_str());
+            else
+            if (known != upstreams.end())
+                policy.upstream = (int) (known - upstreams.begin());
+            else
+            {
+                // servers without targets are registered after the ones with targets
+                policy.upstream = cache_->addUpstream(dns->address, dns->name);
+                upstreams.push_back(dns->name);
+            }
+        }
+        policies_.push_back(policy);
+
+        for (auto it = entry.clients.begin(); it != entry.clients.end(); ++it)
+        {
+            int result = clients_.add(*it, (uint8_t) policies_.size() - 1);
+            if (result == DNSBERR_DUPLICATED_RULE)
+                LOG_MESSAGE("  [!] Duplicated subnet '%s' in policy '%s'\n", it->c_str(), entry.name.c_str());
+            else
+            if (result != DNSBERR_OK)
+                LOG_MESSAGE("  [!] Invalid subnet '%s' in policy '%s'\n", it->c_str(), entry.name.c_str());
+        }
+    }
+
+    if (clients_.size() == 0) return;
+    clients_.build();
+    const char *unit = nullptr;
+    float mem = memoryUnit(clients_.memory(), &unit);
+    LOG_MESSAGE("Generated client table with %d subnets for %d policies (%2.3f %s)\n", (int) clients_.size(),
+        (int) policies_.size() - 1, mem, unit);
+}
+
+
+/*
+ * Rules of a list file, read by 'readRules'. The rules are stored one after
+ * another in 'text', so reading a list doesn't allocate memory per rule.
+ */
+struct RuleList
+{
+    std::string fileName;
+    bool good;
+    std::vector<char> text;
+    std::vector< std::pair<uint32_t, uint32_t> > rules; // offset and length in 'text'
+    std::vector<uint32_t> lines; // line of each rule in the file
+    std::vector<uint32_t> hashes; // prefilter hashes of the rules
+};
+
+
+static void readRules( RuleList *list, bool useFilter )
+{
+    list->good = scanRuleFile(list->fileName, [list, useFilter]( const char *rule, size_t length, uint32_t line )
+    {
+        list->rules.push_back(std::make_pair((uint32_t) list->text.size(), (uint32_t) length));
+        list->lines.push_back(line);
+        list->text.insert(list->text.end(), rule, rule + length);
+        if (useFilter) list->hashes.push_back(BloomFilter::hash(rule, length));
+    });
+}
+
+
+/*
+ * Read the list files concurrently, one file per task.
+ */
+static void readRules( std::vector<RuleList> &lists, bool useFilter )
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&lists, &next, useFilter]()
+    {
+        for (size_t i = next++; i < lists.size(); i = next++) readRules(&lists[i], useFilter);
+    };
+
+    size_t count = std::min(lists.size(), (size_t) std::max(std::thread::hardware_concurrency(), 1U));
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < count; ++i) threads.push_back(std::thread(worker));
+    worker();
+    for (auto it = threads.begin(); it != threads.end(); ++it) it->join();
+}
+
+
+/*
+ * Add the rules of the given files with the given verdict. The prefilter
+ * hashes of the new rules are appended to 'hashes', which is set to null if
+ * the prefilter can't be built (i.e. an image was mapped). Patterns are only
+ * stored; the caller compiles them. The file and line of each rule in the tree
+ * are kept in the rule statistics. Blacklist rules are added to 'category'.
+ */
 bool Processor::loadRules(
     const std::vector<std::string> &fileNames,
-    Tree<uint8_t> &tree )
+    RuleSet &rules,
+    uint8_t verdict,
+    std::vector<uint32_t> *&hashes,
+    uint8_t category )
 {
     if (fileNames.empty()) return false;
 
-    tree.clear();
+    RuleTree &tree = rules.tree;
+    std::vector<RuleList> lists;
 
     for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
     {
-        int c = 0;
-        LOG_MESSAGE("Loading rules from '%s'\n", it->c_str());
+        #ifndef ENABLE_SUFFIX_TABLE
+        // precompiled images are mapped as they are, so they can only be the first
+        // entry of the blacklist (which is loaded first)
+        if (RuleTree::isImage(*it))
+        {
+            if (it != fileNames.begin() || verdict != VERDICT_DENY || category != 0)
+                LOG_MESSAGE("  [!] Ignoring image '%s' (must be the first entry of the blacklist)\n", it->c_str());
+            else
+            if (tree.load(*it))
+            {
+                LOG_MESSAGE("Mapped rule image '%s'\n", it->c_str());
+                // the image has no lines, but every rule without origin comes from it
+                rules.stats.unknown(*it);
+                // we don't have the rules of the image to build the prefilter
+                hashes = nullptr;
+            }
+            else
+                LOG_MESSAGE("  [!] Invalid or incompatible image '%s'\n", it->c_str());
+            continue;
+        }
+        #endif
 
-        std::ifstream rules(it->c_str());
-        if (!rules.good()) return false;
+        lists.push_back(RuleList());
+        lists.back().fileName = *it;
+    }
 
-        std::string line;
+    // parse the files in parallel and merge the rules in the order of the files
+    readRules(lists, hashes != nullptr);
 
-        while (!rules.eof())
-        {
-            std::getline(rules, line);
-            if (line.empty()) continue;
+    // find the redundant rules of all files at once
+    RuleOptimizer optimizer;
+    bool prune = config_.prune_rules();
+    if (prune)
+    {
+        for (auto it = lists.begin(); it != lists.end(); ++it)
+            for (auto rit = it->rules.begin(); rit != it->rules.end(); ++rit)
+                optimizer.add(it->text.data() + rit->first, rit->second);
+        optimizer.optimize();
+    }
+    size_t index = 0;
+    std::string optimized;
+
+    for (auto it = lists.begin(); it != lists.end(); ++it)
+    {
+        int c = 0;
+        int pruned = 0;
+        LOG_MESSAGE("Loading rules from '%s'\n", it->fileName.c_str());
+        if (!it->good) return false;
+        uint32_t source = rules.stats.source(it->fileName);
 
-            // remove comments
-            size_t pos = line.find('#');
-            if (pos != std::string::npos) line = line.substr(0, pos);
+        for (size_t i = 0; i < it->rules.size(); ++i)
+        {
+            const char *rule = it->text.data() + it->rules[i].first;
+            size_t length = it->rules[i].second;
+            if (prune)
+            {
+                // the optimized rule has the same domain, so the hash is the same
+                if (!optimizer.rule(index++, optimized))
+                {
+                    ++pruned;
+                    continue;
+                }
+                rule = optimized.c_str();
+                length = optimized.length();
+            }
+            // patterns are not in the tree, so they don't need to pass the prefilter
+            if (GlobRules::isPattern(rule, length))
+            {
+                int result = rules.globs.add(rule, length, verdict);
+                if (result == DNSBERR_OK)
+                    ++c;
+                else
+                if (result == DNSBERR_DUPLICATED_RULE)
+                    LOG_MESSAGE("  [!] Duplicated '%.*s'\n", (int) length, rule);
+                else
+                    LOG_MESSAGE("  [!] Invalid rule '%.*s'\n", (int) length, rule);
+                continue;
+            }
 
-            int result = tree.add(line, 0, &line);
-            if (line.empty()) continue;
+            uint32_t ids[2] = { 0, 0 };
+            int result = tree.mark(rule, length, verdict, 0, nullptr, ids, category);
 
             if (result == DNSBERR_OK)
             {
+                for (int j = 0; j < 2; ++j)
+                    if (ids[j] != 0) rules.stats.origin(ids[j], source, it->lines[i]);
+                if (hashes != nullptr) hashes->push_back(it->hashes[i]);
                 ++c;
                 continue;
             }
             else
             if (result == DNSBERR_DUPLICATED_RULE)
-                LOG_MESSAGE("  [!] Duplicated '%s'\n", line.c_str());
+                LOG_MESSAGE("  [!] Duplicated '%.*s'\n", (int) length, rule);
             else
-                LOG_MESSAGE("  [!] Invalid rule '%s'\n", line.c_str());
+                LOG_MESSAGE("  [!] Invalid rule '%.*s'\n", (int) length, rule);
         }
 
-        rules.close();
-        LOG_MESSAGE("  Loaded %d rules\n", c);
+        if (pruned > 0)
+            LOG_MESSAGE("  Loaded %d rules (%d redundant rules removed)\n", c, pruned);
+        else
+            LOG_MESSAGE("  Loaded %d rules\n", c);
+        // release the memory as we go
+        std::vector<char>().swap(it->text);
+        std::vector< std::pair<uint32_t, uint32_t> >().swap(it->rules);
+        std::vector<uint32_t>().swap(it->lines);
+        std::vector<uint32_t>().swap(it->hashes);
     }
 
-    float mem = (float) tree.memory();
-    const char *unit = "bytes";
-    if (mem > 1024 * 1024)
+    return true;
+}
+
+
+RuleSet *Processor::loadRuleSet()
+{
+    RuleSet *rules = new RuleSet();
+    // hashes of the rule domains, used to build the prefilter
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> *hashes = (config_.use_prefilter()) ? &keys : nullptr;
+
+    loadRules(config_.blacklist, *rules, VERDICT_DENY, hashes);
+    // each category is loaded apart, so its rules aren't pruned by the wildcards of other categories
+    for (size_t i = 0; i < config_.categories.size() && i + 1 < VERDICT_CATEGORIES; ++i)
     {
-        mem /= 1024 * 1024;
-        unit = "MiB";
+        LOG_MESSAGE("Loading category '%s'%s\n", config_.categories[i].name.c_str(),
+            (config_.categories[i].disabled()) ? " (disabled)" : "");
+        loadRules(config_.categories[i].lists, *rules, VERDICT_DENY, hashes, (uint8_t) (i + 1));
     }
-    else
-    if (mem > 1024)
+    loadRules(config_.whitelist, *rules, VERDICT_ALLOW, hashes);
+
+    // the targets of the external DNS servers, in the order given to 'addUpstream'
+    uint8_t upstream = 0;
+    for (auto it = config_.external_dns.begin(); it != config_.external_dns.end(); ++it)
     {
-        mem /= 1024;
-        unit = "KiB";
+        if (it->targets.empty()) continue;
+        // the line of a target is its position in the list
+        uint32_t source = rules->stats.source("targets of '" + it->name + "'");
+        for (auto tit = it->targets.begin(); tit != it->targets.end(); ++tit)
+        {
+            std::string clean;
+            uint32_t ids[2] = { 0, 0 };
+            int result = rules->tree.mark(*tit, VERDICT_FORWARD, upstream, &clean, ids);
+            if (result == DNSBERR_OK)
+            {
+                for (int j = 0; j < 2; ++j)
+                {
+                    if (ids[j] != 0)
+                        rules->stats.origin(ids[j], source, (uint32_t) (tit - it->targets.begin()) + 1);
+                }
+                if (hashes != nullptr) hashes->push_back(BloomFilter::hash(clean));
+            }
+            else
+            if (result == DNSBERR_DUPLICATED_RULE)
+                LOG_MESSAGE("  [!] Duplicated target '%s'\n", clean.c_str());
+            else
+                LOG_MESSAGE("  [!] Invalid target '%s'\n", clean.c_str());
+        }
+        ++upstream;
     }
-    LOG_MESSAGE("Generated tree with %d nodes (%2.3f %s)\n\n", tree.size(), mem, unit);
 
-    return true;
+    const char *unit = nullptr;
+    float mem = memoryUnit(rules->tree.memory(), &unit);
+    LOG_MESSAGE("Generated tree with %d nodes (%2.3f %s)\n", rules->tree.size(), mem, unit);
+    if (hashes != nullptr)
+    {
+        rules->prefilter.build(keys);
+        mem = memoryUnit(rules->prefilter.memory(), &unit);
+        LOG_MESSAGE("Generated prefilter with %d keys (%2.3f %s, %.3f%% false positives per label)\n",
+            (int) keys.size(), mem, unit, rules->prefilter.falsePositiveRate() * 100.0F);
+    }
+    compileGlobs(rules->globs);
+    loadKeywords(*rules);
+    rules->stats.resize(rules->tree.limit());
+    LOG_MESSAGE("\n");
+
+    return rules;
+}
+
+
+/*
+ * Build the automaton of the patterns. If it's too large, the patterns are
+ * ignored.
+ */
+void Processor::compileGlobs( GlobRules &globs )
+{
+    // compiling without patterns clears the automaton (e.g. the last one was removed)
+    if (!globs.compile())
+    {
+        LOG_MESSAGE("  [!] Ignoring %d patterns (more than %d states)\n", (int) globs.size(), GLOB_MAX_STATES);
+        return;
+    }
+    if (globs.size() == 0) return;
+    const char *unit = nullptr;
+    float mem = memoryUnit(globs.memory(), &unit);
+    LOG_MESSAGE("Generated automaton with %d states for %d patterns (%2.3f %s)\n", globs.automaton().size(),
+        (int) globs.size(), mem, unit);
+}
+
+
+/*
+ * Build the automaton of the keywords in the configuration.
+ */
+void Processor::loadKeywords( RuleSet &rules )
+{
+    for (auto it = config_.keywords.begin(); it != config_.keywords.end(); ++it)
+    {
+        std::string clean;
+        int result = rules.keywords.add(*it, &clean);
+        if (result == DNSBERR_DUPLICATED_RULE)
+            LOG_MESSAGE("  [!] Duplicated keyword '%s'\n", clean.c_str());
+        else
+        if (result != DNSBERR_OK)
+            LOG_MESSAGE("  [!] Invalid keyword '%s'\n", clean.c_str());
+    }
+    if (rules.keywords.size() == 0) return;
+
+    rules.keywords.compile();
+    const char *unit = nullptr;
+    float mem = memoryUnit(rules.keywords.memory(), &unit);
+    LOG_MESSAGE("Generated automaton with %d states for %d keywords (%2.3f %s)\n", rules.keywords.automaton().size(),
+        (int) rules.keywords.size(), mem, unit);
+}
+
+
+/*
+ * Wait until the receiving thread is done with any pointer replaced before
+ * the call: the epoch is advanced, and a read in an older epoch is waited.
+ */
+void Processor::synchronize()
+{
+    uint64_t epoch = ++epoch_;
+
+    uint64_t current = reader_.load();
+    while (current != 0 && current < epoch)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        current = reader_.load();
+    }
+}
+
+
+// replace the current rules, deleting the previous ones once nobody is reading them
+void Processor::publish( RuleSet *rules )
+{
+    RuleSet *previous = rules_.exchange(rules);
+    synchronize();
+    delete previous;
 }
 
+
 #ifdef ENABLE_DNS_CONSOLE
+/*
+ * Add or remove a single rule without reloading the lists. The change is made
+ * in a copy of the console changes of the current rules (see 'RuleDelta'),
+ * which is then published in their place.
+ */
+void Processor::editRule( const std::string &rule, bool blacklist, bool add )
+{
+    std::lock_guard<std::mutex> guard(reload_);
+
+    RuleSet *rules = rules_.load();
+    const RuleDelta *current = rules->delta.load();
+    RuleDelta *delta = (current != nullptr) ? new RuleDelta(*current) : new RuleDelta();
+    RuleEdit edit = { rule, (uint8_t) ((blacklist) ? VERDICT_DENY : VERDICT_ALLOW), add };
+    const char *name = (blacklist) ? "blacklist" : "whitelist";
+
+    std::string clean = rule;
+    uint32_t ids[2] = { 0, 0 };
+    int result = editDelta(*rules, *delta, edit, clean, ids);
+    if (result != DNSBERR_OK)
+    {
+        if (result == DNSBERR_DUPLICATED_RULE)
+            LOG_MESSAGE("\nRule '%s' is already in the %s\n", clean.c_str(), name);
+        else
+        if (result == DNSBERR_MISSING_RULE)
+            LOG_MESSAGE("\nRule '%s' is not in the %s\n", clean.c_str(), name);
+        else
+            LOG_MESSAGE("\nInvalid rule '%s'\n", clean.c_str());
+        delete delta;
+        return;
+    }
+    edits_.push_back(edit);
+    // the rules created by the edit start counting, even if their ids belonged to removed rules
+    delta->stats.resize(delta->added.limit());
+    uint32_t source = delta->stats.source("console");
+    for (int j = 0; j < 2; ++j)
+        if (ids[j] != 0) delta->stats.reset(ids[j], source, 0);
+
+    RuleDelta *previous = rules->delta.exchange(delta);
+    synchronize();
+    // nobody counts hits in the previous delta anymore, so its counters are carried over
+    if (previous != nullptr)
+    {
+        for (int j = 0; j < 2; ++j)
+            if (ids[j] != 0) previous->stats.reset(ids[j], 0, 0);
+        delta->stats.merge(previous->stats);
+    }
+    delete previous;
+    LOG_MESSAGE("\n%s '%s' %s the %s\n", (add) ? "Added" : "Removed", clean.c_str(),
+        (add) ? "to" : "from", name);
+}
+
+
+// number of rules named by a rule of a list ('**' names the domain and the wildcard)
+static int ruleCount( const std::string &rule )
+{
+    size_t start = rule.find_first_not_of(" \t");
+    return (start != std::string::npos && rule.compare(start, 3, "**.") == 0) ? 2 : 1;
+}
+
+
+/*
+ * Restore a verdict removed from the rules of a set. 'found' gets the number
+ * of rules of the set with the verdict. Returns whether any was restored.
+ */
+static bool restoreRule( const RuleSet &rules, RuleDelta &delta, const std::string &rule, uint8_t verdict,
+    int &found )
+{
+    bool restored = false;
+    found = 0;
+    rules.tree.visit(rule, [&delta, &restored, &found, verdict]( const Verdict &value, bool exact, uint32_t id )
+    {
+        if ((((exact) ? value.domain : value.subdomains) & verdict) == 0) return;
+        ++found;
+        auto it = delta.removed.find(((uint64_t) id << 1) | (exact ? 1U : 0U));
+        if (it == delta.removed.end() || (it->second & verdict) == 0) return;
+        it->second = (uint8_t) (it->second & ~verdict);
+        if (it->second == 0) delta.removed.erase(it);
+        restored = true;
+    });
+    return restored;
+}
+
+
+/*
+ * Hide a verdict of the rules of a set that have it. Returns whether any was
+ * hidden.
+ */
+static bool hideRule( const RuleSet &rules, RuleDelta &delta, const std::string &rule, uint8_t verdict )
+{
+    bool hidden = false;
+    rules.tree.visit(rule, [&delta, &hidden, verdict]( const Verdict &value, bool exact, uint32_t id )
+    {
+        if ((((exact) ? value.domain : value.subdomains) & verdict) == 0) return;
+        uint8_t &current = delta.removed[((uint64_t) id << 1) | (exact ? 1U : 0U)];
+        if (current & verdict) return;
+        current = (uint8_t) (current | verdict);
+        hidden = true;
+    });
+    return hidden;
+}
+
+
+/*
+ * Apply a console edit to the changes of a set of rules. Rules of the set
+ * only have their verdicts hidden (and restored); other rules are added to
+ * and removed from the delta itself. The ids of the rules created in the
+ * delta are stored in 'ids' (see 'mark').
+ */
+int Processor::editDelta( const RuleSet &rules, RuleDelta &delta, const RuleEdit &edit, std::string &clean,
+    uint32_t *ids )
+{
+    if (GlobRules::isPattern(edit.rule))
+    {
+        if (!delta.globs) delta.globs.reset(new GlobRules(rules.globs));
+        int result = (edit.add) ? delta.globs->add(edit.rule, edit.verdict, &clean) :
+            delta.globs->remove(edit.rule, edit.verdict);
+        if (result == DNSBERR_OK) compileGlobs(*delta.globs);
+        return result;
+    }
+
+    if (edit.add)
+    {
+        int found = 0;
+        bool restored = restoreRule(rules, delta, edit.rule, edit.verdict, found);
+        if (found == ruleCount(edit.rule)) return (restored) ? DNSBERR_OK : DNSBERR_DUPLICATED_RULE;
+
+        int result = delta.added.mark(edit.rule, edit.verdict, 0, &clean, ids);
+        return (result == DNSBERR_DUPLICATED_RULE && restored) ? DNSBERR_OK : result;
+    }
+
+    int result = delta.added.unmark(edit.rule, edit.verdict);
+    return (hideRule(rules, delta, edit.rule, edit.verdict)) ? DNSBERR_OK : result;
+}
+
+
+/*
+ * Apply the console edits to rules that are not published yet (i.e. loaded by
+ * a reload), so they survive it. The edits are made in the rules themselves,
+ * except for the removal of rules of a mapped image, which is read-only: those
+ * rules are hidden by a delta, like the console does.
+ */
+void Processor::replayEdits( RuleSet &rules )
+{
+    if (edits_.empty()) return;
+
+    RuleDelta *delta = new RuleDelta();
+    bool patterns = false;
+    uint32_t source = rules.stats.source("console");
+    for (auto it = edits_.begin(); it != edits_.end(); ++it)
+    {
+        if (GlobRules::isPattern(it->rule))
+        {
+            if (it->add)
+                rules.globs.add(it->rule, it->verdict);
+            else
+                rules.globs.remove(it->rule, it->verdict);
+            patterns = true;
+            continue;
+        }
+        if (!it->add)
+        {
+            rules.tree.unmark(it->rule, it->verdict);
+            hideRule(rules, *delta, it->rule, it->verdict);
+            continue;
+        }
+
+        int found = 0;
+        restoreRule(rules, *delta, it->rule, it->verdict, found);
+        std::string clean;
+        uint32_t ids[2] = { 0, 0 };
+        if (rules.tree.mark(it->rule, it->verdict, 0, &clean, ids) != DNSBERR_OK) continue;
+        rules.prefilter.add(BloomFilter::hash(clean));
+        rules.stats.resize(rules.tree.limit());
+        for (int j = 0; j < 2; ++j)
+            if (ids[j] != 0) rules.stats.origin(ids[j], source, 0);
+    }
+    if (patterns) compileGlobs(rules.globs);
+    if (delta->removed.empty())
+        delete delta;
+    else
+        rules.delta = delta;
+    LOG_MESSAGE("Applied %d console edits\n\n", (int) edits_.size());
+}
+
+
 void Processor::console( const std::string &command )
 {
     if (command == "reload")
     {
-        loadRules(config_.blacklist, blacklist_);
-        loadRules(config_.whitelist, whitelist_);
-        cache_->reset(); // TODO: we really need this?
+        // the receiving thread keeps using the current rules while the new ones are loaded
+        std::lock_guard<std::mutex> guard(reload_);
+        RuleSet *rules = loadRuleSet();
+        replayEdits(*rules);
+        publish(rules);
+    }
+    else
+    if (command.length() > 3 && (command[0] == '+' || command[0] == '-') &&
+        (command[1] == 'b' || command[1] == 'w') && command[2] == ' ')
+    {
+        editRule(command.substr(3), command[1] == 'b', command[0] == '+');
     }
     else
     if (command == "ef")
@@ -180,6 +746,12 @@ void Processor::console( const std::string &command )
         useFiltering_ = false;
     }
     else
+    if (command.length() > 3 && (command[0] == 'e' || command[0] == 'd') && command[1] == 'c' &&
+        command[2] == ' ')
+    {
+        toggleCategory(command.substr(3), command[0] == 'e');
+    }
+    else
     if (command == "eh")
     {
         LOG_MESSAGE("\nHeuristics enabled!\n");
@@ -197,108 +769,377 @@ void Processor::console( const std::string &command )
         LOG_MESSAGE("\nDumping DNS cache to '%s'\n\n", config_.dump_path_.c_str());
         cache_->dump(config_.dump_path_);
     }
+    else
+    if (command == "profile")
+    {
+        // 'reload_' keeps the rules from being replaced while they're walked
+        std::lock_guard<std::mutex> guard(reload_);
+        TreeProfile profile;
+        rules_.load()->tree.profile(profile);
+        #ifdef ENABLE_SUFFIX_TABLE
+        int layout = PROFILE_SUFFIX;
+        #else
+        int layout = PROFILE_RADIX;
+        #endif
+        LOG_MESSAGE("\n%s\n", profileReport<Verdict>(profile, layout).c_str());
+    }
+    else
+    if (command == "hits")
+        reportHits(20);
+    else
+    if (command.length() > 5 && command.compare(0, 5, "hits ") == 0)
+        reportHits((size_t) std::max(atoi(command.c_str() + 5), 1));
+    else
+    if (command == "unused")
+        reportUnused();
 }
-#endif
 
 
-static void blockAddress( int type, Address &address )
+/*
+ * Enable or disable the blacklist rules of a category. The receiving
+ * thread checks the categories of each rule against the enabled ones, so the
+ * rules don't change.
+ */
+void Processor::toggleCategory( const std::string &name, bool enable )
 {
-    static const uint16_t IPV6_ADDRESS[] = DNS_BLOCKED_IPV6_ADDRESS;
-    address.type = type;
-    if (type == DNS_TYPE_A)
-        address.ipv4 = DNS_BLOCKED_IPV4_ADDRESS;
-    else
-        memcpy(address.ipv6, IPV6_ADDRESS, sizeof(IPV6_ADDRESS));
+    for (size_t i = 0; i < config_.categories.size() && i + 1 < VERDICT_CATEGORIES; ++i)
+    {
+        if (config_.categories[i].name != name) continue;
+        uint16_t bit = (uint16_t) (1U << (i + 1));
+        if (enable)
+            categories_.fetch_or(bit);
+        else
+            categories_.fetch_and((uint16_t) ~bit);
+        LOG_MESSAGE("\nCategory '%s' %s!\n", name.c_str(), (enable) ? "enabled" : "disabled");
+        return;
+    }
+    LOG_MESSAGE("\nUnknown category '%s'\n", name.c_str());
+}
+
+
+/*
+ * Visit the rules in use: the rules of the tree, without the ones removed from
+ * the console, and the ones added from the console. 'visitor' receives the
+ * statistics, the id and the text of each rule.
+ */
+template<typename F>
+static void visitRules( const RuleSet &rules, F visitor )
+{
+    const RuleDelta *delta = rules.delta.load();
+    rules.tree.rules([&rules, delta, &visitor]( uint32_t id, const std::string &rule, const Verdict &value )
+    {
+        bool exact = rule[0] != '*';
+        uint8_t removed = (delta != nullptr) ? delta->removal(id, exact) : 0;
+        if ((((exact) ? value.domain : value.subdomains) & ~removed) == 0) return;
+        visitor(rules.stats, id, rule);
+    });
+    if (delta == nullptr) return;
+    delta->added.rules([delta, &visitor]( uint32_t id, const std::string &rule, const Verdict & )
+    {
+        visitor(delta->stats, id, rule);
+    });
 }
 
 
+/*
+ * Log the rules with most hits since the rules were loaded, with the file and
+ * line of each one, and how many rules were never hit.
+ */
+void Processor::reportHits( size_t count )
+{
+    // 'reload_' keeps the rules from being replaced while they're walked
+    std::lock_guard<std::mutex> guard(reload_);
+    const RuleSet *rules = rules_.load();
+
+    // the best rules so far in a min-heap, so the rule with fewer hits is replaced first
+    typedef std::pair<uint32_t, std::pair<std::string, std::string> > Entry;
+    std::vector<Entry> top;
+    size_t total = 0, unused = 0;
+    visitRules(*rules, [&]( const RuleStats &stats, uint32_t id, const std::string &rule )
+    {
+        ++total;
+        uint32_t hits = stats.hits(id);
+        if (hits == 0)
+        {
+            ++unused;
+            return;
+        }
+        if (top.size() == count && hits <= top.front().first) return;
+        top.push_back(Entry(hits, std::make_pair(rule, stats.origin(id))));
+        std::push_heap(top.begin(), top.end(), std::greater<Entry>());
+        if (top.size() > count)
+        {
+            std::pop_heap(top.begin(), top.end(), std::greater<Entry>());
+            top.pop_back();
+        }
+    });
+    std::sort_heap(top.begin(), top.end(), std::greater<Entry>());
+
+    LOG_MESSAGE("\nTop %d rules of %d (%d never hit)\n\n", (int) top.size(), (int) total, (int) unused);
+    for (auto it = top.begin(); it != top.end(); ++it)
+        LOG_MESSAGE("%10u  %-40s  %s\n", it->first, it->second.first.c_str(), it->second.second.c_str());
+}
+
+
+/*
+ * Write the rules that were never hit since the rules were loaded, with the
+ * file and line of each one, so they can be pruned from the lists.
+ */
+void Processor::reportUnused()
+{
+    std::lock_guard<std::mutex> guard(reload_);
+    const RuleSet *rules = rules_.load();
+
+    FILE *output = fopen(config_.unused_path_.c_str(), "wt");
+    if (output == nullptr)
+    {
+        LOG_MESSAGE("\nUnable to write unused rules to '%s'\n", config_.unused_path_.c_str());
+        return;
+    }
+    int count = 0;
+    visitRules(*rules, [&]( const RuleStats &stats, uint32_t id, const std::string &rule )
+    {
+        if (stats.hits(id) != 0) return;
+        fprintf(output, "%-40s  # %s\n", rule.c_str(), stats.origin(id).c_str());
+        ++count;
+    });
+    fclose(output);
+    LOG_MESSAGE("\nWrote %d unused rules to '%s'\n", count, config_.unused_path_.c_str());
+}
+#endif
+
+
 bool Processor::sendError(
-    const dns_message_t &request,
+    const dns_message_view &request,
     int rcode,
     const Endpoint &endpoint )
 {
-    if (request.questions.size() == 0) return false;
-    buffer bio;
-    dns_message_t response;
-    response.header.id = request.header.id;
-    response.header.flags |= DNS_FLAG_QR;
-    response.questions.push_back(request.questions[0]);
-    response.header.rcode = (uint8_t) rcode;
-    response.write(bio);
-    return conn_->send(endpoint, bio.data(), bio.cursor());
+    uint8_t response[DNS_RESPONSE_SIZE];
+    size_t size = dns_error(request, rcode, response);
+    return conn_->send(endpoint, response, size);
 }
 
-bool Processor::isRandomDomain( std::string name )
+/*
+ * Match the QNAME against the rules and apply the policy of the client.
+ * Only called by the receiving thread (see 'reader_').
+ */
+void Processor::decide(
+    const dns_message_view &request,
+    const Endpoint &endpoint,
+    Decision &decision )
 {
-    if (name.find("www.") == 0)
-        name = name.c_str() + 4;
-    if (name.find("cloudfront") == std::string::npos)
+    // policy of the client's group (the default one for unknown clients)
+    const ClientPolicy &policy = policies_[(endpoint.address.type == ADDR_TYPE_A) ?
+        clients_.find(endpoint.address.ipv4) : 0];
+
+    // find every rule matching the domain in a single walk (in wire format, in place)
+    const uint8_t *qname = request.qname();
+    size_t size = request.qnameSize;
+    uint8_t verdicts = 0;
+    int upstream = -1;
+
+    // announce the epoch before loading the rules so 'publish' doesn't delete them
+    reader_ = epoch_.load();
+    const RuleSet *rules = rules_.load();
+    const RuleDelta *delta = rules->delta.load();
+    uint16_t categories = (uint16_t) (categories_.load(std::memory_order_relaxed) & policy.categories);
+    // returns whether the rule applies ('removed' has the verdicts removed from the console)
+    auto apply = [&verdicts, &upstream, categories]( const Verdict &verdict, bool exact, uint8_t removed ) -> bool
+    {
+        uint8_t current = (uint8_t) (((exact) ? verdict.domain : verdict.subdomains) & ~removed);
+        // blacklist rules only apply if one of their categories is enabled
+        if ((current & VERDICT_DENY) && (verdict.categories[(exact) ? 0 : 1] & categories) == 0)
+            current = (uint8_t) (current & ~VERDICT_DENY);
+        // the target closest to the top-level domain chooses the external DNS
+        if ((current & VERDICT_FORWARD) && upstream < 0) upstream = verdict.upstream[(exact) ? 0 : 1];
+        verdicts = (uint8_t) (verdicts | current);
+        return current != 0;
+    };
+    // the prefilter rejects most of the domains without rules without walking the tree
+    if (rules->prefilter.contains(qname, size))
     {
-        int i = 0;
-        for (char c : name) if (c == '.') ++i;
-        if (i > 1) return false;
+        rules->tree.walk(qname, size, [&apply, rules, delta]( const Verdict &verdict, bool exact, uint32_t id )
+        {
+            if (apply(verdict, exact, (delta != nullptr) ? delta->removal(id, exact) : 0)) rules->stats.hit(id);
+        });
     }
+    const GlobRules *globs = &rules->globs;
+    if (delta != nullptr)
+    {
+        delta->added.walk(qname, size, [&apply, delta]( const Verdict &verdict, bool exact, uint32_t id )
+        {
+            if (apply(verdict, exact, 0)) delta->stats.hit(id);
+        });
+        if (delta->globs) globs = delta->globs.get();
+    }
+    verdicts = (uint8_t) (verdicts | globs->match(qname, size));
+    verdicts = (uint8_t) (verdicts | rules->keywords.match(qname, size));
+    reader_ = 0;
+
+    // check whether the domain is blocked (the whitelist takes precedence)
+    decision.heuristic = false;
+    decision.blocked = false;
+    if (useFiltering_ && policy.filtering && (verdicts & VERDICT_ALLOW) == 0)
+    {
+        if (useHeuristics_ && policy.heuristics)
+            decision.blocked = decision.heuristic = heuristics_.isRandom(qname, size);
+        if (!decision.blocked)
+            decision.blocked = (verdicts & VERDICT_DENY) != 0;
+    }
+    // the targets of the rules take precedence over the external DNS of the group
+    decision.upstream = (upstream < 0) ? policy.upstream : upstream;
+}
 
-    auto pos = name.find('.');
-    if (pos == std::string::npos) return false;
-    name = name.substr(0, pos);
 
-    if (name.length() < 10) return false;
+// whether the queries of the type are answered with a single address (see 'reply')
+static bool isAddressType( uint16_t type )
+{
+    #ifdef DNS_IPV6_EXPERIMENT
+    return type == DNS_TYPE_A || type == DNS_TYPE_AAAA;
+    #else
+    return type == DNS_TYPE_A;
+    #endif
+}
+
 
-    int gon = 0; // group of numbers a0bc32de1 = 3
-    char gs = 0; // group size
-    char bgs = 0; // biggest group size
-    int vc = 0; // vowel count
-    int cc = 0; // consonant count
+// log the query according to the monitoring flags
+void Processor::monitor(
+    const dns_message_view &request,
+    const Endpoint &endpoint,
+    const Decision &decision,
+    int result,
+    const Address &address,
+    const Address &dnsAddress )
+{
+    const char *COLOR_RED = (useColors_) ? "\033[31m" : "";
+    const char *COLOR_YELLOW = (useColors_) ? "\033[33m" : "";
+    const char *COLOR_RESET = (useColors_) ? "\033[39m" : "";
+
+    // print information about the request
+    auto flags = (int32_t) config_.monitoring_;
+    const char *status = nullptr;
+    const char *color = COLOR_RED;
 
-    const char *c = name.c_str();
-    while (*c != 0)
+    if (decision.blocked && flags & MONITOR_SHOW_DENIED)
     {
-        if (isdigit(*c))
-            ++gs;
-        else
-        if (strchr("aeiouAEIOU", *c) != nullptr)
-            ++vc;
+        status = "DE";
+        color = COLOR_RED;
+    }
+    else
+    if (result == DNSB_STATUS_CACHE && flags & MONITOR_SHOW_CACHE)
+    {
+        status = "CA";
+        color = COLOR_RESET;
+    }
+    else
+    if (result == DNSB_STATUS_RECURSIVE && flags & MONITOR_SHOW_RECURSIVE)
+    {
+        status = "RE";
+        color = COLOR_RESET;
+    }
+    else
+    if (result == DNSB_STATUS_FAILURE && flags & MONITOR_SHOW_FAILURE)
+    {
+        status = "FA";
+        color = COLOR_YELLOW;
+    }
+    else
+    if (result == DNSB_STATUS_NXDOMAIN && flags & MONITOR_SHOW_NXDOMAIN)
+    {
+        status = "NX";
+        color = COLOR_YELLOW;
+    }
+
+    if (status != nullptr)
+    {
+        // queries of other types show their type in place of the address
+        bool isAddress = isAddressType(request.qtype);
+        std::string addr;
+        if (!decision.blocked) addr = (isAddress) ? address.toString(true) : dns_typeName(request.qtype);
+        char host[DNS_NAME_SIZE];
+        request.name(host);
+
+        #ifdef DNS_IPV6_EXPERIMENT
+        static const char *FORMAT = "%s%-40s  %s %c  %-8s  %-40s  %s%s\n";
+        #else
+        static const char *FORMAT = "%s%-15s  %s %c  %-8s  %-15s  %s%s\n";
+        #endif
+        LOG_TIMED(FORMAT,
+            color,
+            endpoint.address.toString().c_str(),
+            status,
+            (!isAddress) ? '-' : (request.qtype == ADDR_TYPE_AAAA) ? '6' : '4',
+            (decision.heuristic) ? "*" : dnsAddress.name.c_str(),
+            addr.c_str(),
+            host,
+            COLOR_RESET);
+    }
+}
+
+
+/*
+ * Log the query and send the response: the blocked address, the resolved one
+ * or an error. Blocked queries of other types get an empty answer (NODATA).
+ */
+void Processor::reply(
+    const dns_message_view &request,
+    const Endpoint &endpoint,
+    const Decision &decision,
+    int result,
+    const Address &address,
+    const Address &dnsAddress )
+{
+    monitor(request, endpoint, decision, result, address, dnsAddress);
+
+    // decide whether we have to include an answer
+    if (decision.blocked && !isAddressType(request.qtype))
+        sendError(request, DNS_RCODE_NOERROR, endpoint);
+    else
+    if (!decision.blocked && result != DNSB_STATUS_CACHE && result != DNSB_STATUS_RECURSIVE)
+    {
+        if (result == DNSB_STATUS_NXDOMAIN)
+            sendError(request, DNS_RCODE_NXDOMAIN, endpoint);
         else
-            ++cc;
-        if (gs > 0)
-        {
-            ++gon;
-            if (bgs < gs) bgs = gs;
-            gs = 0;
-        }
-        ++c;
+            sendError(request, DNS_RCODE_SERVFAIL, endpoint);
+    }
+    else
+    {
+        // copy the request and append the answer (the blocked address comes with the template)
+        uint8_t response[DNS_RESPONSE_SIZE];
+        size_t size = dns_answer(request, (decision.blocked) ? nullptr : &address, response);
+        conn_->send(endpoint, response, size);
     }
+}
 
-    //if (gon == 0) return false; // require digits
-    if (bgs > 4) return true; // at least 5 digits in the biggest group
-    if (gon > 1) return true; // at least 2 groups
-    if ((float) vc / (float) name.length() < 0.3F) return true; // less than 30% of vowels
-    return false;
+
+// log the query and send the response of the external DNS (or SERVFAIL if there's none)
+void Processor::relay(
+    const dns_message_view &request,
+    const Endpoint &endpoint,
+    const Decision &decision,
+    int result,
+    const uint8_t *response,
+    size_t size,
+    const Address &dnsAddress )
+{
+    if (result != DNSB_STATUS_CACHE && result != DNSB_STATUS_RECURSIVE)
+    {
+        reply(request, endpoint, decision, result, Address(), dnsAddress);
+        return;
+    }
+    monitor(request, endpoint, decision, result, Address(), dnsAddress);
+    conn_->send(endpoint, response, size);
 }
 
+
+// resolve the queries that need the external DNS
 void Processor::process(
     Processor *object,
-    int num,
     std::mutex *mutex,
     std::condition_variable *cond )
 {
-    (void) num;
     std::unique_lock<std::mutex> guard(*mutex);
 
-    const char *COLOR_RED = "\033[31m";
-    const char *COLOR_YELLOW = "\033[33m";
-    const char *COLOR_RESET = "\033[39m";
-
-#if !defined(_WIN32) && !defined(_WIN64)
-    if (!isatty(STDIN_FILENO))
-#endif
-    {
-        COLOR_RED = "";
-        COLOR_YELLOW = "";
-        COLOR_RESET = "";
-    }
-
     while (object->running_)
     {
         Job *job = object->pop();
@@ -308,131 +1149,19 @@ void Processor::process(
             continue;
         }
 
-        Endpoint &endpoint = job->endpoint;
-        dns_message_t &request = job->request;
-
-        // check whether the domain is blocked
-        bool isHeuristic = false;
-        bool isBlocked = false;
-        if (object->useFiltering_)
-        {
-            if (object->whitelist_.match(request.questions[0].qname) == nullptr)
-            {
-                if (object->useHeuristics_)
-                    isBlocked = isHeuristic = isRandomDomain(request.questions[0].qname);
-                if (!isBlocked)
-                    isBlocked = object->blacklist_.match(request.questions[0].qname) != nullptr;
-            }
-        }
+        // the entry may have been cached since the job was queued
         Address address, dnsAddress;
-        int result = 0;
-
-        // if the domain is not blocked, we retrieve the IP address from the cache
-        if (!isBlocked)
-        {
-            // assume NXDOMAIN for domains without periods (e.g. local host names)
-            // otherwise we try the external DNS
-            if (request.questions[0].qname.find('.') == std::string::npos)
-                result = DNSB_STATUS_NXDOMAIN;
-            else
-            if (request.header.flags & DNS_FLAG_RD)
-                result = object->cache_->resolve(request.questions[0].qname, request.questions[0].type, dnsAddress, address);
-            else
-                result = DNSB_STATUS_NXDOMAIN;
-        }
-        else
-        {
-            blockAddress(request.questions[0].type, address);
-        }
-
-        // print information about the request
-        auto flags = (int32_t) object->config_.monitoring_;
-        const char *status = nullptr;
-        const char *color = COLOR_RED;
-
-        if (isBlocked && flags & MONITOR_SHOW_DENIED)
-        {
-            status = "DE";
-            color = COLOR_RED;
-        }
-        else
-        if (result == DNSB_STATUS_CACHE && flags & MONITOR_SHOW_CACHE)
-        {
-            status = "CA";
-            color = COLOR_RESET;
-        }
-        else
-        if (result == DNSB_STATUS_RECURSIVE && flags & MONITOR_SHOW_RECURSIVE)
-        {
-            status = "RE";
-            color = COLOR_RESET;
-        }
-        else
-        if (result == DNSB_STATUS_FAILURE && flags & MONITOR_SHOW_FAILURE)
-        {
-            status = "FA";
-            color = COLOR_YELLOW;
-        }
-        else
-        if (result == DNSB_STATUS_NXDOMAIN && flags & MONITOR_SHOW_NXDOMAIN)
+        if (isAddressType(job->request.qtype))
         {
-            status = "NX";
-            color = COLOR_YELLOW;
-        }
-
-        if (status != nullptr)
-        {
-            std::string addr;
-            if (!isBlocked) addr = address.toString(true);
-
-            #ifdef DNS_IPV6_EXPERIMENT
-            static const char *FORMAT = "%s%-40s  %s %c  %-8s  %-40s  %s%s\n";
-            #else
-            static const char *FORMAT = "%s%-15s  %s %c  %-8s  %-15s  %s%s\n";
-            #endif
-            LOG_TIMED(FORMAT,
-                color,
-                endpoint.address.toString().c_str(),
-                status,
-                (request.questions[0].type == ADDR_TYPE_AAAA) ? '6' : '4',
-                (isHeuristic) ? "*" : dnsAddress.name.c_str(),
-                addr.c_str(),
-                request.questions[0].qname.c_str(),
-                COLOR_RESET);
-        }
-
-        // decide whether we have to include an answer
-        if (!isBlocked && result != DNSB_STATUS_CACHE && result != DNSB_STATUS_RECURSIVE)
-        {
-            if (result == DNSB_STATUS_NXDOMAIN)
-                object->sendError(request, DNS_RCODE_NXDOMAIN, endpoint);
-            else
-                object->sendError(request, DNS_RCODE_SERVFAIL, endpoint);
+            int result = object->cache_->resolve(job->request, job->decision.upstream, dnsAddress, address);
+            object->reply(job->request, job->endpoint, job->decision, result, address, dnsAddress);
         }
         else
         {
-            // response message
-            buffer bio;
-            dns_message_t response;
-            response.header.id = request.header.id;
-            response.header.flags |= DNS_FLAG_QR;
-            if (request.header.flags & DNS_FLAG_RD)
-            {
-                response.header.flags |= DNS_FLAG_RA;
-                response.header.flags |= DNS_FLAG_RD;
-            }
-            // copy the request question
-            response.questions.push_back(request.questions[0]);
-            dns_record_t answer;
-            answer.qname = request.questions[0].qname;
-            answer.type = request.questions[0].type;
-            answer.clazz = request.questions[0].clazz;
-            answer.ttl = DNS_ANSWER_TTL;
-            answer.rdata = address;
-            response.answers.push_back(answer);
-
-            response.write(bio);
-            object->conn_->send(endpoint, bio.data(), bio.cursor());
+            uint8_t response[DNS_PACKET_SIZE];
+            size_t size = 0;
+            int result = object->cache_->forward(job->request, job->decision.upstream, dnsAddress, response, &size);
+            object->relay(job->request, job->endpoint, job->decision, result, response, size, dnsAddress);
         }
 
         delete job;
@@ -456,34 +1185,63 @@ void Processor::run()
 
     running_ = true;
     for (int i = 0; i < NUM_THREADS; ++i)
-        pool[i].thread = new std::thread(process, this, i + 1, &pool[i].mutex, &cond);
+        pool[i].thread = new std::thread(process, this, &pool[i].mutex, &cond);
 
     while (running_)
     {
         // receive the UDP message
-        buffer bio;
-        size_t size = bio.size();
-        if (!conn_->receive(endpoint, bio.data(), &size, 2000)) continue;
-        bio.resize(size);
-
-        // parse the message
-        dns_message_t request;
-        request.read(bio);
-
-        // ignore messages with the number of questions other than 1
-        int type = 0;
-        if (request.questions.size() == 1) type = request.questions[0].type;
-        #ifdef DNS_IPV6_EXPERIMENT
-        if (type != DNS_TYPE_A && type != DNS_TYPE_AAAA)
-        #else
-        if (type != DNS_TYPE_A)
-        #endif
+        uint8_t data[DNS_BUFFER_SIZE];
+        size_t size = sizeof(data);
+        if (!conn_->receive(endpoint, data, &size, 2000)) continue;
+
+        // validate the message in place, so refused queries are never copied;
+        // malformed messages are ignored
+        dns_message_view request;
+        if (!request.read(data, size)) continue;
+
+        // refuse messages with the number of questions other than 1 and zone transfers;
+        // types other than A (and AAAA) are forwarded as received
+        if (request.qdcount != 1 || request.qtype == DNS_TYPE_AXFR || request.qtype == DNS_TYPE_IXFR)
         {
             sendError(request, DNS_RCODE_REFUSED, endpoint);
             continue;
         }
 
-        push( new Job(endpoint, request) );
+        // answer blocked domains, cache hits and local names right away (run to completion);
+        // only the queries that need the external DNS are handed to the workers
+        Decision decision;
+        decide(request, endpoint, decision);
+        Address address;
+        int result = 0;
+        if (!decision.blocked)
+        {
+            // assume NXDOMAIN for domains without periods (e.g. local host names)
+            // and for queries without recursion
+            if (request.labels < 2 || (request.flags & DNS_FLAG_RD) == 0)
+                result = DNSB_STATUS_NXDOMAIN;
+            else
+            if (isAddressType(request.qtype))
+            {
+                if (cache_->find(request, address)) result = DNSB_STATUS_CACHE;
+            }
+            else
+            {
+                uint8_t response[DNS_PACKET_SIZE];
+                size_t length = 0;
+                if (cache_->find(request, response, &length))
+                {
+                    relay(request, endpoint, decision, DNSB_STATUS_CACHE, response, length, Address());
+                    continue;
+                }
+            }
+        }
+        if (decision.blocked || result != 0)
+        {
+            reply(request, endpoint, decision, result, address, Address());
+            continue;
+        }
+
+        push( new Job(endpoint, request, decision) );
         cond.notify_all();
     }
 
@@ -3,25 +3,129 @@
 
 
 #include <list>
+#include <cstring>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
 #include "socket.hh"
 #include "dns.hh"
+#include "radix.hh"
+#include "suffix.hh"
+#include "filter.hh"
+#include "glob.hh"
+#include "keyword.hh"
+#include "stats.hh"
+#include "policy.hh"
+#include "heuristic.hh"
 #include "protogen.hh"
 #include "config.pg.hh"
 
 namespace dnsblocker {
 
+#ifdef ENABLE_SUFFIX_TABLE
+typedef SuffixTable<Verdict> RuleTree;
+#else
+typedef RadixTree<Verdict> RuleTree;
+#endif
+
+// rule added or removed from the console
+struct RuleEdit
+{
+    std::string rule;
+    uint8_t verdict;
+    bool add;
+};
+
+
+/*
+ * Changes made from the console to a set of rules, so an edit copies a few
+ * rules instead of the whole set. 'added' has the new rules (with their own
+ * statistics) and 'removed' the verdicts taken from the rules of the set, by
+ * the id of the rule shifted left once, plus one for the domain rule. Once a
+ * pattern is edited, 'globs' replaces the patterns of the set.
+ */
+struct RuleDelta
+{
+    RuleTree added;
+    std::unordered_map<uint64_t, uint8_t> removed;
+    std::unique_ptr<GlobRules> globs;
+    RuleStats stats;
+
+    RuleDelta()
+    {
+    }
+
+    RuleDelta( const RuleDelta &that ) : added(that.added), removed(that.removed),
+        globs((that.globs) ? new GlobRules(*that.globs) : nullptr), stats(that.stats)
+    {
+    }
+
+    // verdicts removed from a rule of the set
+    uint8_t removal( uint32_t id, bool exact ) const
+    {
+        if (removed.empty()) return 0;
+        auto it = removed.find(((uint64_t) id << 1) | (exact ? 1U : 0U));
+        return (it == removed.end()) ? 0 : it->second;
+    }
+};
+
+
+/*
+ * Rules used to filter the queries. The whitelist, the blacklist and the
+ * targets of the external DNS servers share one tree, so a single walk finds
+ * every verdict for a host name; rules with asterisks in the middle of the
+ * name are matched by 'globs' instead, and tokens that may appear anywhere in
+ * the name by 'keywords'. A reload builds a new set and publishes it with a
+ * single pointer swap, so the receiving thread never sees partially loaded
+ * rules. 'stats' counts the hits of the rules in the tree. Console
+ * edits are published in 'delta' (null until the first one) the same way.
+ */
+struct RuleSet
+{
+    RuleTree tree;
+    GlobRules globs;
+    KeywordRules keywords;
+    BloomFilter prefilter;
+    RuleStats stats;
+    std::atomic<RuleDelta*> delta;
+
+    RuleSet() : delta(nullptr)
+    {
+    }
+
+    ~RuleSet()
+    {
+        delete delta.load();
+    }
+};
+
+
+// what the rules and the policy of the client decided for a query
+struct Decision
+{
+    bool blocked;
+    bool heuristic;  // blocked by the heuristics
+    int upstream;    // external DNS (see 'DNSCache::addUpstream') or -1 for the default one
+};
+
+
+// query that needs the external DNS, handed to the workers
 struct Job
 {
     Endpoint endpoint;
-    dns_message_t request;
+    buffer packet; // message as received
+    dns_message_view request; // view of 'packet'
+    Decision decision;
 
-    Job( Endpoint &endpoint, dns_message_t &request )
+    Job( const Endpoint &endpoint, const dns_message_view &request, const Decision &decision ) :
+        packet(request.size), request(request), decision(decision)
     {
         this->endpoint = endpoint;
-        this->request.swap(request);
+        memcpy(packet.data(), request.data, request.size);
+        this->request.data = packet.data();
     }
 };
 
@@ -35,7 +139,6 @@ class Processor
         Job *pop();
         void run();
         bool finish();
-        static bool isRandomDomain( std::string name );
         void console( const std::string &command );
 
     private:
@@ -45,19 +148,53 @@ class Processor
         Address bindIP_;
         DNSCache *cache_;
         Configuration config_;
-        Tree<uint8_t> blacklist_;
-        Tree<uint8_t> whitelist_;
-        Tree<uint32_t> nameserver_;
+        std::atomic<RuleSet*> rules_;
+        std::atomic<uint64_t> epoch_;
+        // epoch in which the receiving thread is reading 'rules_' (zero if it's not reading);
+        // it's the only thread matching queries against the rules
+        std::atomic<uint64_t> reader_;
+        std::mutex reload_;
+        // console edits since the start, applied again to the rules of each reload
+        std::vector<RuleEdit> edits_;
         bool running_;
         bool useHeuristics_;
         bool useFiltering_;
+        bool useColors_;
+        // enabled categories of blacklist rules (bit N for category N; category 0 is always enabled)
+        std::atomic<uint16_t> categories_;
+        // policies of the client groups (the first one is the default) and the subnets of each group
+        std::vector<ClientPolicy> policies_;
+        PolicyTable clients_;
+        // detector of random domains used by the heuristics
+        RandomDomainModel heuristics_;
 
-        static void process( Processor *object, int num, std::mutex *mutex, std::condition_variable *cond );
+        static void process( Processor *object, std::mutex *mutex, std::condition_variable *cond );
+        void decide( const dns_message_view &request, const Endpoint &endpoint, Decision &decision );
+        void monitor( const dns_message_view &request, const Endpoint &endpoint, const Decision &decision,
+            int result, const Address &address, const Address &dnsAddress );
+        void reply( const dns_message_view &request, const Endpoint &endpoint, const Decision &decision,
+            int result, const Address &address, const Address &dnsAddress );
+        void relay( const dns_message_view &request, const Endpoint &endpoint, const Decision &decision,
+            int result, const uint8_t *response, size_t size, const Address &dnsAddress );
         bool sendError(
-            const dns_message_t &request,
+            const dns_message_view &request,
             int rcode,
             const Endpoint &endpoint );
-        bool loadRules( const std::vector<std::string> &fileNames, Tree<uint8_t> &tree );
+        bool loadRules( const std::vector<std::string> &fileNames, RuleSet &rules, uint8_t verdict,
+            std::vector<uint32_t> *&hashes, uint8_t category = 0 );
+        RuleSet *loadRuleSet();
+        void loadPolicies();
+        void compileGlobs( GlobRules &globs );
+        void loadKeywords( RuleSet &rules );
+        void synchronize();
+        void publish( RuleSet *rules );
+        void editRule( const std::string &rule, bool blacklist, bool add );
+        int editDelta( const RuleSet &rules, RuleDelta &delta, const RuleEdit &edit, std::string &clean,
+            uint32_t *ids );
+        void replayEdits( RuleSet &rules );
+        void toggleCategory( const std::string &name, bool enable );
+        void reportHits( size_t count );
+        void reportUnused();
         static std::string realPath( const std::string &path );
 };
 
@@ -0,0 +1,83 @@
+#include "profile.hh"
+#include <cstdio>
+#include <cstdarg>
+
+
+static const char *LAYOUT_NAMES[PROFILE_LAYOUTS] = { "dense", "sparse", "radix", "suffix" };
+
+
+static void append( std::string &output, const char *format, ... )
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    output += line;
+}
+
+
+static double percent( size_t value, size_t total )
+{
+    return (total == 0) ? 0.0 : (double) value * 100.0 / (double) total;
+}
+
+
+static double mebibytes( size_t bytes )
+{
+    return (double) bytes / (1024.0 * 1024.0);
+}
+
+
+// rows of a histogram, skipping empty buckets ('open' if the last bucket also counts larger values)
+static void histogram( std::string &output, const char *title, const char *unit, const size_t *values,
+    size_t count, size_t first, bool open )
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) total += values[i];
+    if (total == 0) return;
+
+    append(output, "\n%-14s %12s\n", title, unit);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (values[i] == 0) continue;
+        append(output, "  %3zu%-9s %12zu  %5.1f%%\n", i + first, (open && i + 1 == count) ? "+" : "", values[i],
+            percent(values[i], total));
+    }
+}
+
+
+/*
+ * Format a profile as text. 'layouts' has the projected size (in bytes) of
+ * each PROFILE_* layout, or zero if it's unknown.
+ */
+std::string profileReport( const TreeProfile &profile, const size_t *layouts, int current )
+{
+    std::string output;
+    append(output, "Nodes: %zu (%zu rules, %zu domains, %zu symbols)\n", profile.nodes, profile.rules,
+        profile.domains, profile.characters);
+    append(output, "Memory: %.3f MiB (%.3f MiB wasted in released nodes and pool holes)\n",
+        mebibytes(profile.memory), mebibytes(profile.wasted));
+
+    histogram(output, "Fan-out", "nodes", profile.fanout, NODE_SLOTS + 1, 0, false);
+    histogram(output, "Depth (labels)", "rules", profile.depth, PROFILE_BUCKETS, 1, true);
+    histogram(output, "Chain length", "edges", profile.chains, PROFILE_BUCKETS, 1, true);
+
+    append(output, "\n%-14s %12s\n", "Layout", "MiB");
+    for (int i = 0; i < PROFILE_LAYOUTS; ++i)
+    {
+        if (layouts[i] == 0) continue;
+        append(output, "  %-12s %12.3f", LAYOUT_NAMES[i], mebibytes(layouts[i]));
+        if (i == current)
+            append(output, "  (current)");
+        else
+        if (i == PROFILE_DENSE)
+        {
+            // every node has a slot per symbol, but only one slot points to each node
+            size_t empty = sizeof(NodeIndex) * (NODE_SLOTS * (profile.characters + 1) - profile.characters);
+            append(output, "  (%.3f MiB in empty slots)", mebibytes(empty));
+        }
+        append(output, "\n");
+    }
+    return output;
+}
@@ -0,0 +1,50 @@
+#ifndef DNSB_PROFILE_HH
+#define DNSB_PROFILE_HH
+
+#include <stdint.h>
+#include <string>
+#include "nodes.hh"
+#include "radix.hh"
+#include "suffix.hh"
+
+
+#define PROFILE_DENSE     0  // 'Tree' with 'Node'
+#define PROFILE_SPARSE    1  // 'Tree' with 'SparseNode'
+#define PROFILE_RADIX     2  // 'RadixTree'
+#define PROFILE_SUFFIX    3  // 'SuffixTable'
+#define PROFILE_LAYOUTS   4
+
+
+std::string profileReport( const TreeProfile &profile, const size_t *layouts, int current );
+
+
+/*
+ * Report the shape of a tree of 'T' and the size the same rules would take in
+ * each layout ('current' is the PROFILE_* of the profiled structure). Trie
+ * layouts can only be projected from the profile of a tree.
+ */
+template<typename T>
+std::string profileReport( const TreeProfile &profile, int current )
+{
+    size_t layouts[PROFILE_LAYOUTS] = { 0 };
+    if (profile.characters > 0)
+    {
+        // one trie node per symbol, plus the root
+        layouts[PROFILE_DENSE] = sizeof(Node<T>) * (profile.characters + 1);
+        layouts[PROFILE_SPARSE] = sizeof(SparseNode<T>) * (profile.characters + 1) +
+            sizeof(NodeIndex) * profile.characters;
+        layouts[PROFILE_RADIX] = sizeof(RadixNode<T>) * profile.nodes + sizeof(NodeIndex) * (profile.nodes - 1) +
+            profile.characters;
+    }
+    // the table is kept at most half full
+    size_t slots = 1024;
+    while (slots < profile.domains * 2) slots *= 2;
+    layouts[PROFILE_SUFFIX] = sizeof(uint32_t) * 2 * slots + sizeof(SuffixEntry<T>) * profile.domains +
+        profile.keys;
+    layouts[current] = profile.memory;
+
+    return profileReport(profile, layouts, current);
+}
+
+
+#endif // DNSB_PROFILE_HH
@@ -0,0 +1,1275 @@
+#ifndef DNSB_RADIX_HH
+#define DNSB_RADIX_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <utility>
+#include <algorithm>
+#include "nodes.hh"
+#include <dns-blocker/errors.hh>
+
+
+/*
+ * Path-compressed (Patricia) variant of 'Tree'. Runs of single-child nodes are
+ * collapsed into one edge whose label is stored in a shared character pool, so
+ * a rule costs roughly one node plus the characters that are not shared with
+ * other rules. Since the labels of the children of a node start with distinct
+ * symbols, a node has a 38-bit occupancy bitmap indexed by the first symbol of
+ * the label plus a dense child array in a pool owned by the tree, so finding a
+ * child takes one popcount.
+ *
+ * Since nodes reference each other and their labels by index, a finished tree
+ * can be saved as a binary image and later mapped read-only and matched in
+ * place, without rebuilding anything. A mapped image is never modified: rules
+ * added afterwards (e.g. the whitelist) go to a tree in the heap, which is
+ * walked after the image.
+ */
+
+
+#define RADIX_IMAGE_MAGIC      "DNSBRDX"
+#define RADIX_IMAGE_VERSION    4
+#define RADIX_IMAGE_ORDER      0x01020304
+
+
+struct RadixImageHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t order;      // RADIX_IMAGE_ORDER in the byte order of the writer
+    uint32_t nodeSize;   // 'sizeof(RadixNode<T>)' of the writer
+    uint32_t nodes;      // number of nodes
+    uint32_t children;   // number of entries in the child pool
+    uint32_t labels;     // size of the label pool in bytes
+};
+
+
+template<typename T>
+struct RadixNode
+{
+    uint64_t bitmap;     // children by the first symbol of their labels
+    NodeIndex children;  // offset of the child array in the child pool
+    uint32_t label;      // offset of the edge label in the label pool
+    uint16_t length;     // length of the edge label
+    uint16_t flags;
+    T value;
+
+    RadixNode() : bitmap(0), children(0), label(0), length(0), flags(0), value()
+    {
+    }
+};
+
+
+template<typename T>
+class RadixTree
+{
+    public:
+        RadixTree();
+        ~RadixTree();
+        RadixTree( const RadixTree &that );
+        RadixTree( RadixTree &&that ) = delete;
+        uint32_t size() const;
+        uint32_t limit() const;
+        size_t memory() const;
+        int add( const std::string &target, const T &value, std::string *clean = nullptr );
+        int add( const char *target, size_t length, const T &value, std::string *clean = nullptr );
+        int remove( const std::string &target );
+        int mark( const std::string &target, uint8_t verdict, uint8_t upstream = 0, std::string *clean = nullptr,
+            uint32_t *ids = nullptr, uint8_t category = 0 );
+        int mark( const char *target, size_t length, uint8_t verdict, uint8_t upstream = 0,
+            std::string *clean = nullptr, uint32_t *ids = nullptr, uint8_t category = 0 );
+        int unmark( const std::string &target, uint8_t verdict );
+        template<typename F>
+        void walk( const uint8_t *qname, size_t size, F visitor ) const;
+        template<typename F>
+        int visit( const std::string &target, F visitor ) const;
+        template<typename F>
+        void rules( F visitor ) const;
+        const RadixNode<T> *match( const std::string &host ) const;
+        const RadixNode<T> *match( const uint8_t *qname, size_t size ) const;
+        void clear();
+        void profile( TreeProfile &profile ) const;
+        bool save( const std::string &path ) const;
+        bool load( const std::string &path );
+        bool mapped() const;
+        static bool isImage( const std::string &path );
+
+    private:
+        std::vector< RadixNode<T> > nodes;
+        // nodes released by 'remove'
+        std::vector<NodeIndex> freed;
+        std::vector<NodeIndex> children;
+        std::vector<NodeIndex> holes[NODE_SLOTS + 1];
+        std::vector<char> labels;
+        // read-only image mapped by 'load'
+        const void *mapping;
+        // previous images, kept mapped because other threads may still be reading them
+        std::vector< std::pair<const void*, size_t> > retired;
+        size_t mappingSize;
+        const RadixNode<T> *imageNodes;
+        const NodeIndex *imageChildren;
+        const char *imageLabels;
+        uint32_t imageSize;
+        uint32_t imageChildrenSize;
+        uint32_t imageLabelsSize;
+
+        int insert( const char *key, uint16_t flags, const T &value );
+        NodeIndex locate( const char *key, uint16_t stop );
+        NodeIndex lookup( const char *key, bool image ) const;
+        bool covered( const char *key, uint8_t verdict, uint16_t categories, bool image ) const;
+        const RadixNode<T> *search( const char *key, bool image ) const;
+        const RadixNode<T> *search( WireName &name, bool image ) const;
+        template<typename F>
+        void descend( WireName &name, bool image, F &visitor ) const;
+        template<typename F>
+        void enumerate( bool image, F visitor ) const;
+        void collect( TreeProfile &profile, bool image ) const;
+        NodeIndex find( NodeIndex parent, int idx ) const;
+        NodeIndex allocate();
+        NodeIndex create( const char *key, size_t length );
+        void link( NodeIndex parent, int idx, NodeIndex child );
+        void unlink( NodeIndex parent, int idx );
+        void merge( NodeIndex parent, NodeIndex index );
+        template<typename V>
+        static void combine( V &value, const V &other );
+        static void combine( Verdict &value, const Verdict &other );
+};
+
+
+template<typename T>
+RadixTree<T>::RadixTree() : mapping(nullptr), mappingSize(0), imageNodes(nullptr),
+    imageChildren(nullptr), imageLabels(nullptr), imageSize(0), imageChildrenSize(0), imageLabelsSize(0)
+{
+    clear();
+}
+
+
+/*
+ * Copy the tree. The copy of a mapped image is stored in the heap, merged with
+ * the rules added on top of it (whose ids change).
+ */
+template<typename T>
+RadixTree<T>::RadixTree( const RadixTree &that ) : mapping(nullptr), mappingSize(0), imageNodes(nullptr),
+    imageChildren(nullptr), imageLabels(nullptr), imageSize(0), imageChildrenSize(0), imageLabelsSize(0)
+{
+    if (that.mapping != nullptr)
+    {
+        nodes.assign(that.imageNodes, that.imageNodes + that.imageSize);
+        children.assign(that.imageChildren, that.imageChildren + that.imageChildrenSize);
+        labels.assign(that.imageLabels, that.imageLabels + that.imageLabelsSize);
+        that.enumerate(false, [this]( const RadixNode<T> &node, uint32_t, const std::string &path )
+        {
+            NodeIndex index = locate(path.c_str(), 0);
+            combine(nodes[index].value, node.value);
+            nodes[index].flags = (uint16_t) (nodes[index].flags | node.flags);
+        });
+    }
+    else
+    {
+        nodes = that.nodes;
+        freed = that.freed;
+        children = that.children;
+        for (size_t i = 0; i <= NODE_SLOTS; ++i) holes[i] = that.holes[i];
+        labels = that.labels;
+    }
+}
+
+
+template<typename T>
+RadixTree<T>::~RadixTree()
+{
+    if (mapping != nullptr) unmapFile(mapping, mappingSize);
+    for (auto it = retired.begin(); it != retired.end(); ++it) unmapFile(it->first, it->second);
+}
+
+
+template<typename T>
+uint32_t RadixTree<T>::size() const
+{
+    // with an image, the root of the heap is not a node of the tree
+    return imageSize + (uint32_t) (nodes.size() - freed.size()) - ((mapping != nullptr) ? 1 : 0);
+}
+
+
+// upper bound of the rule ids (see 'walk')
+template<typename T>
+uint32_t RadixTree<T>::limit() const
+{
+    return imageSize + (uint32_t) nodes.size();
+}
+
+
+template<typename T>
+size_t RadixTree<T>::memory() const
+{
+    return mappingSize + sizeof(RadixNode<T>) * nodes.size() + sizeof(NodeIndex) * children.size() +
+        labels.size() + sizeof(RadixTree<T>);
+}
+
+
+template<typename T>
+bool RadixTree<T>::mapped() const
+{
+    return mapping != nullptr;
+}
+
+
+template<typename T>
+int RadixTree<T>::add( const std::string &target, const T &value, std::string *clean )
+{
+    return add(target.c_str(), target.length(), value, clean);
+}
+
+
+/*
+ * Same as above, but the rule is given as a span (e.g. in a mapped file).
+ */
+template<typename T>
+int RadixTree<T>::add( const char *target, size_t length, const T &value, std::string *clean )
+{
+    if (target == nullptr || length == 0 || length > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < length; ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+    if (clean != nullptr) *clean = temp;
+
+    uint16_t flags = NODE_TERMINAL;
+    int duplicated = DNSBERR_DUPLICATED_RULE;
+    // '*' and '**' must precede a period
+    if (temp[0] == '*')
+    {
+        flags |= NODE_WILDCARD;
+
+        // if we have a 'double star', add the domain itself (the rule is only
+        // duplicated if both the domain and the wildcard already exist)
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            int result = add(temp + 3, strlen(temp + 3), value);
+            if (result == DNSBERR_OK)
+                duplicated = DNSBERR_OK;
+            else
+            if (result != DNSBERR_DUPLICATED_RULE)
+                return result;
+        }
+        else
+        if (temp[1] != '.')
+            return DNSBERR_INVALID_RULE;
+    }
+
+    // preprocess the host name
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return DNSBERR_INVALID_ARGUMENT;
+
+    // with a mapped image, the rule goes to the heap
+    int result = insert(ptr, flags, value);
+    return (result == DNSBERR_DUPLICATED_RULE) ? duplicated : result;
+}
+
+
+template<typename T>
+NodeIndex RadixTree<T>::find( NodeIndex parent, int idx ) const
+{
+    const RadixNode<T> &node = nodes[parent];
+    uint64_t bit = (uint64_t) 1 << idx;
+    if ((node.bitmap & bit) == 0) return 0;
+    return children[node.children + (NodeIndex) nodePopCount(node.bitmap & (bit - 1))];
+}
+
+
+template<typename T>
+NodeIndex RadixTree<T>::allocate()
+{
+    if (!freed.empty())
+    {
+        NodeIndex index = freed.back();
+        freed.pop_back();
+        return index;
+    }
+    nodes.resize(nodes.size() + 1);
+    return (NodeIndex) (nodes.size() - 1);
+}
+
+
+template<typename T>
+NodeIndex RadixTree<T>::create( const char *key, size_t length )
+{
+    NodeIndex index = allocate();
+    RadixNode<T> &node = nodes[index];
+    node.label = (uint32_t) labels.size();
+    node.length = (uint16_t) length;
+    labels.insert(labels.end(), key, key + length);
+    return index;
+}
+
+
+template<typename T>
+void RadixTree<T>::link( NodeIndex parent, int idx, NodeIndex child )
+{
+    RadixNode<T> &node = nodes[parent];
+    uint64_t bit = (uint64_t) 1 << idx;
+    size_t count = (size_t) nodePopCount(node.bitmap);
+    size_t rank = (size_t) nodePopCount(node.bitmap & (bit - 1));
+
+    if (node.bitmap & bit)
+    {
+        children[node.children + rank] = child;
+        return;
+    }
+
+    // move the child array to a free area with one more entry
+    NodeIndex offset;
+    if (!holes[count + 1].empty())
+    {
+        offset = holes[count + 1].back();
+        holes[count + 1].pop_back();
+    }
+    else
+    {
+        offset = (NodeIndex) children.size();
+        children.resize(children.size() + count + 1);
+    }
+    NodeIndex *from = children.data() + node.children;
+    NodeIndex *to = children.data() + offset;
+    for (size_t i = 0; i < rank; ++i) to[i] = from[i];
+    to[rank] = child;
+    for (size_t i = rank; i < count; ++i) to[i + 1] = from[i];
+    if (count > 0) holes[count].push_back(node.children);
+
+    node.children = offset;
+    node.bitmap |= bit;
+}
+
+
+template<typename T>
+void RadixTree<T>::unlink( NodeIndex parent, int idx )
+{
+    RadixNode<T> &node = nodes[parent];
+    uint64_t bit = (uint64_t) 1 << idx;
+    if ((node.bitmap & bit) == 0) return;
+    size_t count = (size_t) nodePopCount(node.bitmap);
+    size_t rank = (size_t) nodePopCount(node.bitmap & (bit - 1));
+
+    // move the child array to a free area with one less entry
+    NodeIndex offset = 0;
+    if (count > 1)
+    {
+        if (!holes[count - 1].empty())
+        {
+            offset = holes[count - 1].back();
+            holes[count - 1].pop_back();
+        }
+        else
+        {
+            offset = (NodeIndex) children.size();
+            children.resize(children.size() + count - 1);
+        }
+        NodeIndex *from = children.data() + node.children;
+        NodeIndex *to = children.data() + offset;
+        for (size_t i = 0; i < rank; ++i) to[i] = from[i];
+        for (size_t i = rank + 1; i < count; ++i) to[i - 1] = from[i];
+    }
+    holes[count].push_back(node.children);
+
+    node.children = offset;
+    node.bitmap &= ~bit;
+}
+
+
+/*
+ * Collapse a node without rules and with a single child into that child, so
+ * the tree stays path-compressed after 'remove'. The child takes the place of
+ * the node in 'parent' and keeps its index, so the index of a rule never
+ * changes while the rule exists.
+ */
+template<typename T>
+void RadixTree<T>::merge( NodeIndex parent, NodeIndex index )
+{
+    RadixNode<T> &node = nodes[index];
+    NodeIndex child = children[node.children];
+    holes[1].push_back(node.children);
+    RadixNode<T> &next = nodes[child];
+
+    // the labels are usually contiguous, since 'insert' splits edges in place
+    if (next.label != node.label + node.length)
+    {
+        size_t offset = labels.size();
+        labels.resize(offset + node.length + next.length);
+        memcpy(labels.data() + offset, labels.data() + node.label, node.length);
+        memcpy(labels.data() + offset + node.length, labels.data() + next.label, next.length);
+        next.label = (uint32_t) offset;
+    }
+    else
+        next.label = node.label;
+    next.length = (uint16_t) (node.length + next.length);
+
+    const RadixNode<T> &above = nodes[parent];
+    uint64_t bit = (uint64_t) 1 << charToIndex(labels[next.label]);
+    children[above.children + (NodeIndex) nodePopCount(above.bitmap & (bit - 1))] = child;
+
+    node = RadixNode<T>();
+    freed.push_back(index);
+}
+
+
+/*
+ * Find the node of the given key (a prepared host name), creating it and
+ * splitting edges as needed. Returns zero, without changing the tree, if a
+ * node with any of the flags in 'stop' is found on the way.
+ */
+template<typename T>
+NodeIndex RadixTree<T>::locate( const char *key, uint16_t stop )
+{
+    size_t length = strlen(key);
+    NodeIndex current = 0;
+
+    while (length > 0)
+    {
+        int idx = charToIndex(*key);
+        NodeIndex next = find(current, idx);
+        if (next == 0)
+        {
+            // no edge starting with this symbol: the remainder becomes a new leaf
+            next = create(key, length);
+            link(current, idx, next);
+            return next;
+        }
+
+        // find the length of the common prefix
+        const char *label = labels.data() + nodes[next].label;
+        size_t common = 1;
+        while (common < nodes[next].length && common < length && label[common] == key[common]) ++common;
+
+        if (common < nodes[next].length)
+        {
+            // split the edge: 'middle' keeps the common prefix and adopts 'next'
+            NodeIndex split = allocate();
+            nodes[split].label = nodes[next].label;
+            nodes[split].length = (uint16_t) common;
+
+            // 'split' takes the place of 'next' (same first symbol)
+            link(current, idx, split);
+            nodes[next].label += (uint32_t) common;
+            nodes[next].length = (uint16_t) (nodes[next].length - common);
+            link(split, charToIndex(labels[nodes[next].label]), next);
+            next = split;
+        }
+
+        key += common;
+        length -= common;
+        current = next;
+        if (nodes[current].flags & stop) return 0;
+    }
+
+    return current;
+}
+
+
+/*
+ * Returns the node of the given key (a prepared host name) in the mapped image
+ * or in the heap, or zero if there's no such node.
+ */
+template<typename T>
+NodeIndex RadixTree<T>::lookup( const char *key, bool image ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+
+    NodeIndex current = 0;
+    while (*key != 0)
+    {
+        const RadixNode<T> &node = base[current];
+        uint64_t bit = (uint64_t) 1 << charToIndex(*key);
+        if ((node.bitmap & bit) == 0) return 0;
+        current = pool[node.children + (NodeIndex) nodePopCount(node.bitmap & (bit - 1))];
+        const char *label = chars + base[current].label;
+        for (uint16_t i = 0; i < base[current].length; ++i, ++key)
+            if (*key != label[i]) return 0;
+    }
+    return current;
+}
+
+
+template<typename T>
+int RadixTree<T>::insert( const char *key, uint16_t flags, const T &value )
+{
+    NodeIndex index = locate(key, NODE_WILDCARD);
+    if (index == 0 || (nodes[index].flags & NODE_TERMINAL)) return DNSBERR_DUPLICATED_RULE;
+    nodes[index].flags = (uint16_t) (nodes[index].flags | flags);
+    nodes[index].value = value;
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Returns whether a wildcard above the given key (a prepared host name), in
+ * the mapped image or in the heap, already has the given verdicts and
+ * categories.
+ */
+template<typename T>
+bool RadixTree<T>::covered( const char *key, uint8_t verdict, uint16_t categories, bool image ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+
+    const RadixNode<T> *current = base;
+    while (*key != 0)
+    {
+        uint64_t bit = (uint64_t) 1 << charToIndex(*key);
+        if ((current->bitmap & bit) == 0) return false;
+        current = base + pool[current->children + (NodeIndex) nodePopCount(current->bitmap & (bit - 1))];
+        const RadixNode<T> &node = *current;
+        const char *label = chars + node.label;
+        for (uint16_t i = 0; i < node.length; ++i, ++key)
+            if (*key != label[i]) return false;
+        if (*key != 0 && (node.flags & NODE_WILDCARD) && (node.value.subdomains & verdict) == verdict &&
+            (node.value.categories[1] & categories) == categories)
+            return true;
+    }
+    return false;
+}
+
+
+/*
+ * Add a rule to a tree of verdicts ('T' must be 'Verdict'). Unlike 'add',
+ * the given verdicts are merged into the ones the domain (or its subdomains,
+ * for wildcards) already has, so one tree holds the rules of several lists.
+ * The rule is duplicated if the domain already has the verdicts, directly or
+ * through a wildcard (in the same categories). With VERDICT_FORWARD,
+ * 'upstream' is kept along with the verdict, and with VERDICT_DENY, the rule
+ * is added to 'category' (a rule may be in several categories). If 'ids' is
+ * given, the ids (see 'walk') of the domain rule and of the wildcard rule are
+ * stored in 'ids[0]' and 'ids[1]' when the rule is created (i.e. it had no
+ * verdicts), so rules that only get another verdict keep their statistics.
+ * With a mapped image, the verdicts the image doesn't have are marked in the
+ * heap.
+ */
+template<typename T>
+int RadixTree<T>::mark( const std::string &target, uint8_t verdict, uint8_t upstream, std::string *clean,
+    uint32_t *ids, uint8_t category )
+{
+    return mark(target.c_str(), target.length(), verdict, upstream, clean, ids, category);
+}
+
+
+template<typename T>
+int RadixTree<T>::mark( const char *target, size_t length, uint8_t verdict, uint8_t upstream, std::string *clean,
+    uint32_t *ids, uint8_t category )
+{
+    if (target == nullptr || length == 0 || length > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+    if (category >= VERDICT_CATEGORIES) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < length; ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+    if (clean != nullptr) *clean = temp;
+
+    bool wildcard = temp[0] == '*';
+    int duplicated = DNSBERR_DUPLICATED_RULE;
+    // '*' and '**' must precede a period
+    if (wildcard)
+    {
+        // if we have a 'double star', mark the domain itself
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            int result = mark(temp + 3, strlen(temp + 3), verdict, upstream, nullptr, ids, category);
+            if (result == DNSBERR_OK)
+                duplicated = DNSBERR_OK;
+            else
+            if (result != DNSBERR_DUPLICATED_RULE)
+                return result;
+        }
+        else
+        if (temp[1] != '.')
+            return DNSBERR_INVALID_RULE;
+    }
+
+    // preprocess the host name
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return DNSBERR_INVALID_ARGUMENT;
+
+    uint16_t categories = (verdict & VERDICT_DENY) ? (uint16_t) (1U << category) : 0;
+    if (covered(ptr, verdict, categories, false)) return duplicated;
+    if (mapping != nullptr)
+    {
+        if (covered(ptr, verdict, categories, true)) return duplicated;
+        NodeIndex index = lookup(ptr, true);
+        const RadixNode<T> &node = imageNodes[index];
+        if (index != 0 && (node.flags & NODE_TERMINAL) &&
+            (((wildcard) ? node.value.subdomains : node.value.domain) & verdict) == verdict &&
+            (node.value.categories[(wildcard) ? 1 : 0] & categories) == categories)
+            return duplicated;
+    }
+
+    NodeIndex index = locate(ptr, 0);
+    RadixNode<T> &node = nodes[index];
+    uint8_t &current = (wildcard) ? node.value.subdomains : node.value.domain;
+    uint16_t &within = node.value.categories[(wildcard) ? 1 : 0];
+    if ((current & verdict) == verdict && (within & categories) == categories) return duplicated;
+    if (ids != nullptr && current == 0) ids[(wildcard) ? 1 : 0] = imageSize + index;
+    if ((verdict & VERDICT_FORWARD) && (current & VERDICT_FORWARD) == 0)
+        node.value.upstream[(wildcard) ? 1 : 0] = upstream;
+    current = (uint8_t) (current | verdict);
+    within = (uint16_t) (within | categories);
+    node.flags = (uint16_t) (node.flags | ((wildcard) ? NODE_TERMINAL | NODE_WILDCARD : NODE_TERMINAL));
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Remove verdicts added with 'mark'. The rule is removed from the tree once
+ * it has no verdicts left. The rules of a mapped image can't be removed.
+ */
+template<typename T>
+int RadixTree<T>::unmark( const std::string &target, uint8_t verdict )
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    bool wildcard = temp[0] == '*';
+    if (wildcard)
+    {
+        // a 'double star' unmarks the domain and the wildcard
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            int domain = unmark(temp + 3, verdict);
+            int result = unmark(temp + 1, verdict);
+            return (domain == DNSBERR_OK) ? domain : result;
+        }
+        else
+        if (temp[1] != '.')
+            return DNSBERR_INVALID_RULE;
+    }
+
+    std::string rule = temp;
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return DNSBERR_INVALID_ARGUMENT;
+
+    NodeIndex index = lookup(ptr, false);
+    if (index == 0) return DNSBERR_MISSING_RULE;
+    uint8_t &current = (wildcard) ? nodes[index].value.subdomains : nodes[index].value.domain;
+    if ((current & verdict) == 0) return DNSBERR_MISSING_RULE;
+    current = (uint8_t) (current & ~verdict);
+    if (verdict & VERDICT_DENY) nodes[index].value.categories[(wildcard) ? 1 : 0] = 0;
+
+    // release the node once the rule has no verdicts left
+    if (current == 0) return remove(rule);
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Find the rules named by 'target', as given to 'mark' (a '**' rule names the
+ * domain and the wildcard). 'visitor' receives the value, whether it's the
+ * domain rule and the id of each one in the tree (see 'walk').
+ */
+template<typename T>
+template<typename F>
+int RadixTree<T>::visit( const std::string &target, F visitor ) const
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    bool wildcard = temp[0] == '*';
+    if (wildcard)
+    {
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            int domain = visit(temp + 3, visitor);
+            int result = visit(temp + 1, visitor);
+            return (domain == DNSBERR_OK) ? domain : result;
+        }
+        else
+        if (temp[1] != '.')
+            return DNSBERR_INVALID_RULE;
+    }
+
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return DNSBERR_INVALID_ARGUMENT;
+
+    int result = DNSBERR_MISSING_RULE;
+    NodeIndex index = (mapping != nullptr) ? lookup(ptr, true) : 0;
+    if (index != 0 && (imageNodes[index].flags & NODE_TERMINAL))
+    {
+        visitor(imageNodes[index].value, !wildcard, (uint32_t) index);
+        result = DNSBERR_OK;
+    }
+    index = lookup(ptr, false);
+    if (index != 0 && (nodes[index].flags & NODE_TERMINAL))
+    {
+        visitor(nodes[index].value, !wildcard, imageSize + (uint32_t) index);
+        result = DNSBERR_OK;
+    }
+    return result;
+}
+
+
+/*
+ * Visit the rules matching a host name in DNS wire format, from the top-level
+ * domain down. 'visitor' receives the value of each wildcard the name is below
+ * ('exact' is false) and then the value of the name itself, if it's a rule
+ * ('exact' is true), along with the id of the rule: the index of its node,
+ * which doesn't change while the rule exists and is below 'limit'. The nodes
+ * in the heap are numbered after the ones of the mapped image, which is
+ * walked first.
+ */
+template<typename T>
+template<typename F>
+void RadixTree<T>::walk( const uint8_t *qname, size_t size, F visitor ) const
+{
+    WireName name;
+    if (!name.read(qname, size)) return;
+
+    if (mapping != nullptr)
+    {
+        int label = name.label, offset = name.offset;
+        descend(name, true, visitor);
+        // rules added on top of the image, if any
+        if (nodes[0].bitmap == 0) return;
+        name.label = label;
+        name.offset = offset;
+    }
+    descend(name, false, visitor);
+}
+
+
+// walk the mapped image or the heap (see 'walk')
+template<typename T>
+template<typename F>
+void RadixTree<T>::descend( WireName &name, bool image, F &visitor ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+    uint32_t offset = (image) ? 0 : imageSize;
+    const RadixNode<T> *node = base;
+
+    char c = name.next();
+    while (c != 0)
+    {
+        uint64_t bit = (uint64_t) 1 << charToIndex(c);
+        if ((node->bitmap & bit) == 0) return;
+        node = base + pool[node->children + (NodeIndex) nodePopCount(node->bitmap & (bit - 1))];
+        const char *label = chars + node->label;
+        for (uint16_t i = 0; i < node->length; ++i, c = name.next())
+            if (c != label[i]) return;
+
+        if (c != 0)
+        {
+            // wildcard nodes end with a period, so the name is one of their subdomains
+            if (node->flags & NODE_WILDCARD) visitor(node->value, false, offset + (uint32_t) (node - base));
+        }
+        else
+        if (node->flags & NODE_TERMINAL)
+            visitor(node->value, true, offset + (uint32_t) (node - base));
+    }
+}
+
+
+template<typename T>
+const RadixNode<T> *RadixTree<T>::match( const std::string &target ) const
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return nullptr;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    strcpy(temp, target.c_str());
+
+    // preprocess the host name
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return nullptr;
+
+    const RadixNode<T> *node = (mapping != nullptr) ? search(ptr, true) : nullptr;
+    return (node != nullptr) ? node : search(ptr, false);
+}
+
+
+// match a prepared host name against the mapped image or the heap
+template<typename T>
+const RadixNode<T> *RadixTree<T>::search( const char *key, bool image ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+    const RadixNode<T> *node = base;
+
+    while (*key != 0)
+    {
+        uint64_t bit = (uint64_t) 1 << charToIndex(*key);
+        if ((node->bitmap & bit) == 0) return nullptr;
+        node = base + pool[node->children + (NodeIndex) nodePopCount(node->bitmap & (bit - 1))];
+        const char *label = chars + node->label;
+        for (uint16_t i = 0; i < node->length; ++i, ++key)
+            if (*key != label[i]) return nullptr;
+        if (node->flags & NODE_WILDCARD) return node;
+    }
+
+    if ((node->flags & NODE_TERMINAL) != 0)
+        return node;
+    else
+        return nullptr;
+}
+
+
+/*
+ * Match a host name in DNS wire format (e.g. the QNAME of a received message).
+ * The labels are decoded, lowercased and reversed as the tree is walked.
+ */
+template<typename T>
+const RadixNode<T> *RadixTree<T>::match( const uint8_t *qname, size_t size ) const
+{
+    WireName name;
+    if (!name.read(qname, size)) return nullptr;
+
+    if (mapping != nullptr)
+    {
+        int label = name.label, offset = name.offset;
+        const RadixNode<T> *node = search(name, true);
+        if (node != nullptr || nodes[0].bitmap == 0) return node;
+        name.label = label;
+        name.offset = offset;
+    }
+    return search(name, false);
+}
+
+
+// match a host name in DNS wire format against the mapped image or the heap
+template<typename T>
+const RadixNode<T> *RadixTree<T>::search( WireName &name, bool image ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+    const RadixNode<T> *node = base;
+
+    char c = name.next();
+    while (c != 0)
+    {
+        uint64_t bit = (uint64_t) 1 << charToIndex(c);
+        if ((node->bitmap & bit) == 0) return nullptr;
+        node = base + pool[node->children + (NodeIndex) nodePopCount(node->bitmap & (bit - 1))];
+        const char *label = chars + node->label;
+        for (uint16_t i = 0; i < node->length; ++i, c = name.next())
+            if (c != label[i]) return nullptr;
+        if (node->flags & NODE_WILDCARD) return node;
+    }
+
+    if ((node->flags & NODE_TERMINAL) != 0)
+        return node;
+    else
+        return nullptr;
+}
+
+
+/*
+ * Remove a rule added with 'add'. A '**' rule removes both the domain and the
+ * wildcard. Nodes left without rules are released and reused by later
+ * insertions. Rules that were ignored by 'add' because a wildcard already
+ * covered them are not restored, and the rules of a mapped image can't be
+ * removed.
+ */
+template<typename T>
+int RadixTree<T>::remove( const std::string &target )
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    uint16_t flags = NODE_TERMINAL;
+    if (temp[0] == '*')
+    {
+        flags |= NODE_WILDCARD;
+
+        // a 'double star' removes the domain and the wildcard
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            int domain = remove(temp + 3);
+            int wildcard = remove(temp + 1);
+            return (domain == DNSBERR_OK) ? domain : wildcard;
+        }
+        else
+        if (temp[1] != '.')
+            return DNSBERR_INVALID_RULE;
+    }
+
+    // preprocess the host name
+    char *ptr = prepareHostname(temp);
+    if (ptr == nullptr) return DNSBERR_INVALID_ARGUMENT;
+
+    // find the node in the heap (the mapped image is read-only), keeping the path to it
+    NodeIndex path[NODE_MAX_HOST_LENGTH + 1];
+    size_t depth = 0;
+    path[0] = 0;
+    while (*ptr != 0)
+    {
+        NodeIndex next = find(path[depth], charToIndex(*ptr));
+        if (next == 0) return DNSBERR_MISSING_RULE;
+        const char *label = labels.data() + nodes[next].label;
+        for (uint16_t i = 0; i < nodes[next].length; ++i, ++ptr)
+            if (*ptr != label[i]) return DNSBERR_MISSING_RULE;
+        path[++depth] = next;
+    }
+
+    RadixNode<T> &node = nodes[path[depth]];
+    if ((node.flags & flags) != flags) return DNSBERR_MISSING_RULE;
+    node.flags = (uint16_t) (node.flags & ~flags);
+
+    // release the nodes that became useless
+    for (; depth > 0 && nodes[path[depth]].flags == 0 && nodes[path[depth]].bitmap == 0; --depth)
+    {
+        unlink(path[depth - 1], charToIndex(labels[nodes[path[depth]].label]));
+        nodes[path[depth]] = RadixNode<T>();
+        freed.push_back(path[depth]);
+    }
+    if (depth > 0 && nodes[path[depth]].flags == 0 && nodePopCount(nodes[path[depth]].bitmap) == 1)
+        merge(path[depth - 1], path[depth]);
+
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Visit every rule of the tree, depth first. 'visitor' receives the id of the
+ * rule (see 'walk'), the rule as it would be written in a list ('*.' for
+ * wildcards) and its value.
+ */
+template<typename T>
+template<typename F>
+void RadixTree<T>::rules( F visitor ) const
+{
+    std::string rule;
+    auto write = [&visitor, &rule]( const RadixNode<T> &node, uint32_t id, const std::string &path )
+    {
+        // the path is the reversed host name; the one of a wildcard ends with a period
+        rule.assign((node.flags & NODE_WILDCARD) ? "*" : "");
+        rule.append(path.rbegin(), path.rend());
+        visitor(id, rule, node.value);
+    };
+    if (mapping != nullptr) enumerate(true, write);
+    enumerate(false, write);
+}
+
+
+/*
+ * Visit the rules of the mapped image or of the heap, depth first. 'visitor'
+ * receives the node, the id (see 'walk') and the path (a prepared host name)
+ * of each rule.
+ */
+template<typename T>
+template<typename F>
+void RadixTree<T>::enumerate( bool image, F visitor ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+    uint32_t offset = (image) ? 0 : imageSize;
+
+    // nodes to visit, with the length of the path above them
+    std::vector< std::pair<NodeIndex, size_t> > stack(1, std::make_pair((NodeIndex) 0, (size_t) 0));
+    std::string path;
+    while (!stack.empty())
+    {
+        const RadixNode<T> &node = base[stack.back().first];
+        path.resize(stack.back().second);
+        path.append(chars + node.label, node.length);
+        stack.pop_back();
+
+        if (node.flags & NODE_TERMINAL) visitor(node, offset + (uint32_t) (&node - base), path);
+
+        size_t count = (size_t) nodePopCount(node.bitmap);
+        for (size_t i = count; i > 0; --i) stack.push_back(std::make_pair(pool[node.children + i - 1], path.length()));
+    }
+}
+
+
+/*
+ * Collect the shape of the tree (see 'TreeProfile'), depth first.
+ */
+template<typename T>
+void RadixTree<T>::profile( TreeProfile &profile ) const
+{
+    profile = TreeProfile();
+    profile.memory = memory();
+
+    if (mapping != nullptr) collect(profile, true);
+    // with an image, the heap only has the rules added on top of it
+    if (mapping == nullptr || nodes[0].bitmap != 0) collect(profile, false);
+    profile.wasted += sizeof(RadixNode<T>) * freed.size();
+    for (size_t i = 1; i <= NODE_SLOTS; ++i) profile.wasted += sizeof(NodeIndex) * i * holes[i].size();
+}
+
+
+// add the shape of the mapped image or of the heap to 'profile'
+template<typename T>
+void RadixTree<T>::collect( TreeProfile &profile, bool image ) const
+{
+    const RadixNode<T> *base = (image) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (image) ? imageChildren : children.data();
+    const char *chars = (image) ? imageLabels : labels.data();
+    size_t labelSize = (image) ? imageLabelsSize : labels.size();
+    size_t characters = profile.characters;
+
+    struct Visit
+    {
+        NodeIndex index;
+        size_t periods; // periods in the path, above the node
+        size_t length;  // length of the path, above the node
+        bool domain;    // whether the parent is a rule without wildcard
+    };
+    std::vector<Visit> stack;
+    stack.push_back({ 0, 0, 0, false });
+    while (!stack.empty())
+    {
+        Visit visit = stack.back();
+        stack.pop_back();
+        const RadixNode<T> &node = base[visit.index];
+
+        ++profile.nodes;
+        size_t count = (size_t) nodePopCount(node.bitmap);
+        ++profile.fanout[count];
+        if (node.length > 0)
+        {
+            profile.characters += node.length;
+            ++profile.chains[std::min<size_t>(node.length, PROFILE_BUCKETS) - 1];
+        }
+        size_t periods = visit.periods;
+        for (uint16_t i = 0; i < node.length; ++i)
+            if (chars[node.label + i] == '.') ++periods;
+        size_t length = visit.length + node.length;
+
+        bool wildcard = (node.flags & NODE_WILDCARD) != 0;
+        if (node.flags & NODE_TERMINAL)
+        {
+            ++profile.rules;
+            // the path of a wildcard ends with the period before its domain
+            size_t depth = (wildcard) ? periods : periods + 1;
+            ++profile.depth[std::min<size_t>(depth, PROFILE_BUCKETS) - 1];
+            if (!wildcard || node.length != 1 || !visit.domain)
+            {
+                ++profile.domains;
+                profile.keys += (wildcard) ? length - 1 : length;
+            }
+        }
+
+        bool domain = (node.flags & NODE_TERMINAL) && !wildcard;
+        for (size_t i = 0; i < count; ++i)
+            stack.push_back({ pool[node.children + i], periods, length, domain });
+    }
+
+    characters = profile.characters - characters;
+    if (labelSize > characters) profile.wasted += labelSize - characters;
+}
+
+
+template<typename T>
+void RadixTree<T>::clear()
+{
+    // the image is only unmapped by the destructor since 'match' may be running on it
+    if (mapping != nullptr) retired.push_back(std::make_pair(mapping, mappingSize));
+    mapping = nullptr;
+    mappingSize = 0;
+    imageNodes = nullptr;
+    imageChildren = nullptr;
+    imageLabels = nullptr;
+    imageSize = imageChildrenSize = imageLabelsSize = 0;
+
+    nodes.clear();
+    nodes.resize(1);
+    freed.clear();
+    children.clear();
+    for (size_t i = 0; i <= NODE_SLOTS; ++i) holes[i].clear();
+    labels.clear();
+}
+
+
+/*
+ * Merge the value of a rule into the value of the same rule in another tree
+ * (see the copy constructor). Verdicts are merged like 'mark' does.
+ */
+template<typename T>
+template<typename V>
+void RadixTree<T>::combine( V &value, const V &other )
+{
+    value = other;
+}
+
+
+template<typename T>
+void RadixTree<T>::combine( Verdict &value, const Verdict &other )
+{
+    uint8_t *current[2] = { &value.domain, &value.subdomains };
+    uint8_t added[2] = { other.domain, other.subdomains };
+    for (int i = 0; i < 2; ++i)
+    {
+        if ((added[i] & VERDICT_FORWARD) && (*current[i] & VERDICT_FORWARD) == 0)
+            value.upstream[i] = other.upstream[i];
+        *current[i] = (uint8_t) (*current[i] | added[i]);
+        value.categories[i] = (uint16_t) (value.categories[i] | other.categories[i]);
+    }
+}
+
+
+template<typename T>
+bool RadixTree<T>::save( const std::string &path ) const
+{
+    // the rules added on top of an image are saved along with it
+    if (mapping != nullptr && nodes[0].bitmap != 0)
+    {
+        RadixTree<T> copy(*this);
+        return copy.save(path);
+    }
+
+    const RadixNode<T> *base = (mapping != nullptr) ? imageNodes : nodes.data();
+    const NodeIndex *pool = (mapping != nullptr) ? imageChildren : children.data();
+    const char *chars = (mapping != nullptr) ? imageLabels : labels.data();
+    RadixImageHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, RADIX_IMAGE_MAGIC);
+    header.version = RADIX_IMAGE_VERSION;
+    header.order = RADIX_IMAGE_ORDER;
+    header.nodeSize = (uint32_t) sizeof(RadixNode<T>);
+    header.nodes = (mapping != nullptr) ? imageSize : (uint32_t) nodes.size();
+    header.children = (mapping != nullptr) ? imageChildrenSize : (uint32_t) children.size();
+    header.labels = (mapping != nullptr) ? imageLabelsSize : (uint32_t) labels.size();
+
+    // write a temporary file and replace the image at once, since truncating an image
+    // mapped by a running process would crash it
+    std::string temp = path + ".tmp";
+    FILE *output = fopen(temp.c_str(), "wb");
+    if (output == nullptr) return false;
+    bool result = fwrite(&header, sizeof(header), 1, output) == 1 &&
+        fwrite(base, sizeof(RadixNode<T>), header.nodes, output) == header.nodes &&
+        fwrite(pool, sizeof(NodeIndex), header.children, output) == header.children &&
+        fwrite(chars, 1, header.labels, output) == header.labels;
+    result = (fclose(output) == 0) && result;
+    #if defined(_WIN32) || defined(_WIN64)
+    if (result) ::remove(path.c_str());
+    #endif
+    if (result) result = rename(temp.c_str(), path.c_str()) == 0;
+    if (!result) ::remove(temp.c_str());
+    return result;
+}
+
+
+template<typename T>
+bool RadixTree<T>::isImage( const std::string &path )
+{
+    char magic[8] = { 0 };
+    FILE *input = fopen(path.c_str(), "rb");
+    if (input == nullptr) return false;
+    bool result = fread(magic, sizeof(magic), 1, input) == 1 && strcmp(magic, RADIX_IMAGE_MAGIC) == 0;
+    fclose(input);
+    return result;
+}
+
+
+template<typename T>
+bool RadixTree<T>::load( const std::string &path )
+{
+    size_t size = 0;
+    const void *data = mapFile(path, &size);
+    if (data == nullptr) return false;
+
+    const RadixImageHeader *header = (const RadixImageHeader*) data;
+    if (size < sizeof(RadixImageHeader) ||
+        strcmp(header->magic, RADIX_IMAGE_MAGIC) != 0 ||
+        header->version != RADIX_IMAGE_VERSION ||
+        header->order != RADIX_IMAGE_ORDER ||
+        header->nodeSize != sizeof(RadixNode<T>) ||
+        header->nodes == 0 ||
+        (uint64_t) size != sizeof(RadixImageHeader) + (uint64_t) header->nodes * sizeof(RadixNode<T>) +
+            (uint64_t) header->children * sizeof(NodeIndex) + header->labels)
+    {
+        unmapFile(data, size);
+        return false;
+    }
+
+    // validate every index once, so matching never reads outside the image
+    const RadixNode<T> *inodes = (const RadixNode<T>*) ((const uint8_t*) data + sizeof(RadixImageHeader));
+    const NodeIndex *ichildren = (const NodeIndex*) (inodes + header->nodes);
+    for (uint32_t i = 0; i < header->nodes; ++i)
+    {
+        const RadixNode<T> &node = inodes[i];
+        uint32_t count = (uint32_t) nodePopCount(node.bitmap);
+        bool valid = (node.bitmap >> NODE_SLOTS) == 0 &&
+            (uint64_t) node.label + node.length <= header->labels &&
+            (count == 0 || (uint64_t) node.children + count <= header->children);
+        // every child must consume at least one symbol, otherwise 'match' could loop
+        for (uint32_t j = 0; valid && j < count; ++j)
+        {
+            NodeIndex child = ichildren[node.children + j];
+            valid = child != 0 && child < header->nodes && inodes[child].length > 0;
+        }
+        if (!valid)
+        {
+            unmapFile(data, size);
+            return false;
+        }
+    }
+
+    // the heap keeps its root, for the rules added on top of the image
+    clear();
+    mapping = data;
+    mappingSize = size;
+    imageNodes = (const RadixNode<T>*) ((const uint8_t*) data + sizeof(RadixImageHeader));
+    imageChildren = (const NodeIndex*) (imageNodes + header->nodes);
+    imageLabels = (const char*) (imageChildren + header->children);
+    imageSize = header->nodes;
+    imageChildrenSize = header->children;
+    imageLabelsSize = header->labels;
+    return true;
+}
+
+
+#endif // DNSB_RADIX_HH
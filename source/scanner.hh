@@ -0,0 +1,258 @@
+#ifndef DNSB_SCANNER_HH
+#define DNSB_SCANNER_HH
+
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <cstring>
+#include "nodes.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCANNER_SSE2
+#endif
+
+
+/*
+ * Scanner for rule lists. The list is scanned 16 bytes at a time (using SSE2,
+ * when available) for line breaks, comment markers and whitespaces, and the
+ * callback receives each rule as a span of the input, along with the number
+ * of the line (starting at 1). Used with a mapped file, nothing is copied or
+ * allocated per line.
+ *
+ * Besides plain lists (the first word of each line is a rule), hosts files
+ * ('0.0.0.0 ads.example.com') and adblock filter lists ('||example.com^') are
+ * detected and parsed in the same pass. Adblock filters are rewritten as '**.'
+ * rules in a temporary buffer, so the span is only valid during the call.
+ */
+
+
+#define SCANNER_BLOCK   16
+
+#define SCANNER_PLAIN     0  // the first word of each line is a rule
+#define SCANNER_HOSTS     1  // an address followed by host names
+#define SCANNER_ADBLOCK   2  // '||domain^' filters (any other filter is ignored)
+
+
+inline int scannerTrailingZeros( uint32_t value )
+{
+    #if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (int) index;
+    #else
+    return __builtin_ctz(value);
+    #endif
+}
+
+
+/*
+ * Set the bit N of 'breaks' if the byte N is a line break and the bit N of
+ * 'stops' if the byte N ends a word (whitespace or '#').
+ */
+inline void scanBlock( const char *data, size_t size, uint32_t &breaks, uint32_t &stops )
+{
+    #ifdef SCANNER_SSE2
+    if (size == SCANNER_BLOCK)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*) data);
+        __m128i lf = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+        __m128i other = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(block, _mm_set1_epi8('#'))));
+        breaks = (uint32_t) _mm_movemask_epi8(lf);
+        stops = (uint32_t) _mm_movemask_epi8(other);
+        return;
+    }
+    #endif
+
+    breaks = stops = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        char c = data[i];
+        if (c == '\n')
+            breaks |= 1U << i;
+        else
+        if (c == ' ' || c == '\t' || c == '\r' || c == '#')
+            stops |= 1U << i;
+    }
+}
+
+
+// whether the word is an IPv4 or IPv6 address (host names have letters other than 'a'-'f' or no colons)
+inline bool scannerIsAddress( const char *word, size_t length )
+{
+    bool colon = false, dot = false, letter = false;
+    for (size_t i = 0; i < length; ++i)
+    {
+        char c = word[i];
+        if (c == ':')
+            colon = true;
+        else
+        if (c == '%')
+            return colon; // zone of an IPv6 address ('fe80::1%lo0')
+        else
+        if (c == '.')
+            dot = true;
+        else
+        if ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))
+            letter = true;
+        else
+        if (c < '0' || c > '9')
+            return false;
+    }
+    return colon || (dot && !letter);
+}
+
+
+/*
+ * Guess the format of a list from the first word of the list, skipping
+ * comments and blank lines: adblock lists start with a header ('[Adblock Plus
+ * 2.0]'), a comment ('!') or a filter, and hosts files with an address.
+ */
+inline int scanFormat( const char *data, size_t size )
+{
+    size_t i = 0;
+    while (i < size)
+    {
+        char c = data[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+        {
+            ++i;
+            continue;
+        }
+        if (c == '#')
+        {
+            while (i < size && data[i] != '\n') ++i;
+            continue;
+        }
+        if (c == '[' || c == '!' || c == '|' || c == '@') return SCANNER_ADBLOCK;
+
+        size_t end = i;
+        while (end < size && data[end] != ' ' && data[end] != '\t' && data[end] != '\r' && data[end] != '\n' &&
+            data[end] != '#')
+            ++end;
+        return (scannerIsAddress(data + i, end - i)) ? SCANNER_HOSTS : SCANNER_PLAIN;
+    }
+    return SCANNER_PLAIN;
+}
+
+
+/*
+ * Visit the words of each line, until a comment. 'visitor' receives the word,
+ * the number of the line and the index of the word in the line, and returns
+ * whether the rest of the line should be visited.
+ */
+template<typename F>
+void scanWords( const char *data, size_t size, F visitor )
+{
+    size_t start = 0;    // first byte after the last delimiter
+    bool skip = false;   // whether the rest of the current line is ignored
+    int words = 0;       // words of the current line so far
+    uint32_t line = 1;   // number of the current line
+
+    for (size_t base = 0; base < size; base += SCANNER_BLOCK)
+    {
+        uint32_t breaks, stops;
+        size_t length = size - base;
+        scanBlock(data + base, (length < SCANNER_BLOCK) ? length : SCANNER_BLOCK, breaks, stops);
+
+        // visit the delimiters in order; anything between them is part of a word
+        for (uint32_t events = breaks | stops; events != 0; events &= events - 1)
+        {
+            int bit = scannerTrailingZeros(events);
+            size_t pos = base + (size_t) bit;
+            if (pos > start && !skip) skip = !visitor(data + start, pos - start, line, words++);
+            if (breaks & (1U << bit))
+            {
+                skip = false;
+                words = 0;
+                ++line;
+            }
+            else
+            if (data[pos] == '#')
+                skip = true;
+            start = pos + 1;
+        }
+    }
+
+    if (size > start && !skip) visitor(data + start, size - start, line, words);
+}
+
+
+template<typename F>
+void scanRules( const char *data, size_t size, F callback )
+{
+    int format = scanFormat(data, size);
+    if (format == SCANNER_PLAIN)
+    {
+        scanWords(data, size, [&callback]( const char *text, size_t length, uint32_t line, int )
+        {
+            callback(text, length, line);
+            return false;
+        });
+    }
+    else
+    if (format == SCANNER_HOSTS)
+    {
+        scanWords(data, size, [&callback]( const char *text, size_t length, uint32_t line, int index )
+        {
+            if (index == 0)
+            {
+                // a line without address (e.g. a single host name) is taken as a plain rule
+                if (scannerIsAddress(text, length)) return true;
+                callback(text, length, line);
+                return false;
+            }
+            // skip local names ('localhost', 'broadcasthost') and addresses ('0.0.0.0 0.0.0.0')
+            if (memchr(text, '.', length) == nullptr || scannerIsAddress(text, length)) return true;
+            if (length == 21 && memcmp(text, "localhost.localdomain", 21) == 0) return true;
+            callback(text, length, line);
+            return true;
+        });
+    }
+    else
+    {
+        char temp[NODE_MAX_HOST_LENGTH + 4] = { '*', '*', '.' };
+        scanWords(data, size, [&callback, &temp]( const char *text, size_t length, uint32_t line, int )
+        {
+            // only '||domain^' (optionally followed by '|') blocks a domain and its subdomains;
+            // exceptions, options, paths and cosmetic filters don't apply to DNS
+            if (length < 4 || text[0] != '|' || text[1] != '|') return false;
+            const char *end = (const char*) memchr(text + 2, '^', length - 2);
+            if (end == nullptr) return false;
+            size_t domain = (size_t) (end - text) - 2;
+            size_t rest = length - domain - 3;
+            if (domain == 0 || domain > NODE_MAX_HOST_LENGTH || (rest > 0 && (rest > 1 || end[1] != '|'))) return false;
+            if (memchr(text + 2, '/', domain) != nullptr || memchr(text + 2, ':', domain) != nullptr) return false;
+            memcpy(temp + 3, text + 2, domain);
+            callback(temp, domain + 3, line);
+            return false;
+        });
+    }
+}
+
+
+/*
+ * Map the given list file and scan it. Returns false if the file can't be
+ * read.
+ */
+template<typename F>
+bool scanRuleFile( const std::string &path, F callback )
+{
+    size_t size = 0;
+    const void *data = mapFile(path, &size);
+    if (data == nullptr)
+    {
+        // empty files can't be mapped
+        std::ifstream input(path.c_str());
+        return input.good() && input.peek() == std::ifstream::traits_type::eof();
+    }
+
+    scanRules((const char*) data, size, callback);
+    unmapFile(data, size);
+    return true;
+}
+
+
+#endif // DNSB_SCANNER_HH
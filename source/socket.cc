@@ -110,7 +110,7 @@ Address::Address( uint32_t ipv4, const std::string &name ) : name(name), type(AD
 {
 }
 
-Address::Address( const Address &that ) : type(that.type)
+Address::Address( const Address &that ) : name(that.name), type(that.type)
 {
 	memcpy(ipv6, that.ipv6, sizeof(ipv6));
 }
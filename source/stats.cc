@@ -0,0 +1,113 @@
+#include "stats.hh"
+
+namespace dnsblocker {
+
+RuleStats::RuleStats() : size_(0), sources_(1, "unknown")
+{
+}
+
+/*
+ * Copy the origins of the rules. The counters start at zero: the ones of
+ * 'that' keep counting until the copy replaces it, and are added with 'merge'
+ * afterwards, so no hit is lost.
+ */
+RuleStats::RuleStats( const RuleStats &that ) : size_(0), origins_(that.origins_), sources_(that.sources_)
+{
+    resize(that.size_);
+}
+
+/*
+ * Add the counters of 'that' to the ones of the same rules. Nothing may be
+ * counting hits in 'that' anymore.
+ */
+void RuleStats::merge( const RuleStats &that )
+{
+    for (uint32_t i = 0; i < size_ && i < that.size_; ++i)
+    {
+        uint32_t hits = that.counters_[i].load(std::memory_order_relaxed);
+        if (hits != 0) counters_[i].fetch_add(hits, std::memory_order_relaxed);
+    }
+}
+
+/*
+ * Make room for the ids below 'limit', keeping the current counters. Must not
+ * be called while the rules are published.
+ */
+void RuleStats::resize( uint32_t limit )
+{
+    if (limit <= size_) return;
+    std::unique_ptr<std::atomic<uint32_t>[]> counters(new std::atomic<uint32_t>[limit]);
+    for (uint32_t i = 0; i < limit; ++i)
+        counters[i].store((i < size_) ? counters_[i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+    counters_.swap(counters);
+    size_ = limit;
+}
+
+/*
+ * Returns the index of the given source (e.g. a file name), adding it if
+ * needed.
+ */
+uint32_t RuleStats::source( const std::string &name )
+{
+    for (size_t i = 1; i < sources_.size(); ++i)
+        if (sources_[i] == name) return (uint32_t) i;
+    sources_.push_back(name);
+    return (uint32_t) sources_.size() - 1;
+}
+
+/*
+ * Set the name reported for the rules without origin (e.g. the rules of a
+ * mapped image, which are not read from a list).
+ */
+void RuleStats::unknown( const std::string &name )
+{
+    sources_[0] = name;
+}
+
+/*
+ * Set the origin of a rule. A rule keeps its first origin, since the rules
+ * read later with the same domain only add verdicts to it.
+ */
+void RuleStats::origin( uint32_t id, uint32_t source, uint32_t line )
+{
+    if (id >= origins_.size()) origins_.resize((size_t) id + 1, RuleOrigin{ 0, 0 });
+    if (origins_[id].source != 0) return;
+    origins_[id].source = source;
+    origins_[id].line = line;
+}
+
+/*
+ * Start over the counter of a rule with a new origin. Used for rules added
+ * after loading, whose id may have belonged to a rule removed since then.
+ */
+void RuleStats::reset( uint32_t id, uint32_t source, uint32_t line )
+{
+    if (id < size_) counters_[id].store(0, std::memory_order_relaxed);
+    if (id < origins_.size()) origins_[id].source = 0;
+    origin(id, source, line);
+}
+
+// origin of a rule as 'source:line' ('source' alone if there's no line)
+std::string RuleStats::origin( uint32_t id ) const
+{
+    if (id >= origins_.size() || origins_[id].source == 0) return sources_[0];
+    std::string output = sources_[origins_[id].source];
+    if (origins_[id].line != 0) output += ":" + std::to_string(origins_[id].line);
+    return output;
+}
+
+uint32_t RuleStats::hits( uint32_t id ) const
+{
+    if (id >= size_) return 0;
+    return counters_[id].load(std::memory_order_relaxed);
+}
+
+size_t RuleStats::memory() const
+{
+    size_t total = sizeof(std::atomic<uint32_t>) * size_ + sizeof(RuleOrigin) * origins_.capacity() +
+        sizeof(RuleStats);
+    for (auto it = sources_.begin(); it != sources_.end(); ++it) total += it->capacity() + 32;
+    return total;
+}
+
+}
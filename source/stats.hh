@@ -0,0 +1,58 @@
+#ifndef DNSB_STATS_HH
+#define DNSB_STATS_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+
+namespace dnsblocker {
+
+
+// where a rule came from ('source' is zero if it's unknown)
+struct RuleOrigin
+{
+    uint32_t source;
+    uint32_t line;
+};
+
+
+/*
+ * Hit counters of the rules, in a side array indexed by the id of the rule
+ * (see 'walk' in the rule trees), so the nodes don't grow. Counters are only
+ * incremented with relaxed atomics, so counting never waits for the console.
+ * Also keeps the file and line each rule was read from.
+ */
+class RuleStats
+{
+    public:
+        RuleStats();
+        RuleStats( const RuleStats &that );
+        RuleStats &operator=( const RuleStats &that ) = delete;
+        void resize( uint32_t limit );
+        void merge( const RuleStats &that );
+        uint32_t source( const std::string &name );
+        void unknown( const std::string &name );
+        void origin( uint32_t id, uint32_t source, uint32_t line );
+        void reset( uint32_t id, uint32_t source, uint32_t line );
+        std::string origin( uint32_t id ) const;
+        uint32_t hits( uint32_t id ) const;
+        size_t memory() const;
+
+        inline void hit( uint32_t id ) const
+        {
+            if (id < size_) counters_[id].fetch_add(1, std::memory_order_relaxed);
+        }
+
+    private:
+        std::unique_ptr<std::atomic<uint32_t>[]> counters_;
+        uint32_t size_;
+        std::vector<RuleOrigin> origins_;
+        // names of the sources; the first one is reported for rules without origin
+        std::vector<std::string> sources_;
+};
+
+}
+
+#endif // DNSB_STATS_HH
@@ -0,0 +1,840 @@
+#ifndef DNSB_SUFFIX_HH
+#define DNSB_SUFFIX_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "nodes.hh"
+#include <dns-blocker/errors.hh>
+
+
+/*
+ * Rule matcher based on hashes of label suffixes. Each rule is stored once,
+ * keyed by its domain (without the leading '*.' or '**.'), in a flat
+ * open-addressing table. A host name is hashed from right to left so the hash
+ * of every suffix ('com', 'example.com', 'ads.example.com') is available after
+ * a single pass, and matching takes at most one probe per label.
+ *
+ * It has the same interface as 'Tree' and 'RadixTree'. Entries flagged with
+ * NODE_TERMINAL match the domain itself; entries flagged with NODE_WILDCARD
+ * match any of its subdomains.
+ */
+
+
+template<typename T>
+struct SuffixEntry
+{
+    uint32_t key;      // offset of the domain in the key pool
+    uint16_t length;   // length of the domain
+    uint16_t flags;
+    T value;
+
+    SuffixEntry() : key(0), length(0), flags(0), value()
+    {
+    }
+};
+
+
+template<typename T>
+class SuffixTable
+{
+    public:
+        SuffixTable();
+        ~SuffixTable();
+        SuffixTable( const SuffixTable &that ) = default;
+        SuffixTable( SuffixTable &&that ) = delete;
+        uint32_t size() const;
+        uint32_t limit() const;
+        size_t memory() const;
+        int add( const std::string &target, const T &value, std::string *clean = nullptr );
+        int add( const char *target, size_t length, const T &value, std::string *clean = nullptr );
+        int remove( const std::string &target );
+        int mark( const std::string &target, uint8_t verdict, uint8_t upstream = 0, std::string *clean = nullptr,
+            uint32_t *ids = nullptr, uint8_t category = 0 );
+        int mark( const char *target, size_t length, uint8_t verdict, uint8_t upstream = 0,
+            std::string *clean = nullptr, uint32_t *ids = nullptr, uint8_t category = 0 );
+        int unmark( const std::string &target, uint8_t verdict );
+        template<typename F>
+        void walk( const uint8_t *qname, size_t size, F visitor ) const;
+        template<typename F>
+        int visit( const std::string &target, F visitor ) const;
+        template<typename F>
+        void rules( F visitor ) const;
+        const SuffixEntry<T> *match( const std::string &host ) const;
+        const SuffixEntry<T> *match( const uint8_t *qname, size_t size ) const;
+        void clear();
+        void profile( TreeProfile &profile ) const;
+
+    private:
+        struct Slot
+        {
+            uint32_t hash;
+            uint32_t entry;   // index in 'entries' plus one (0 if empty)
+        };
+
+        std::vector<Slot> slots;
+        std::vector< SuffixEntry<T> > entries;
+        // entries released by 'remove'
+        std::vector<uint32_t> freed;
+        std::vector<char> keys;
+        // bytes of 'keys' owned by released entries (see 'compact')
+        size_t released;
+
+        static uint32_t hash( uint32_t current, char c );
+        size_t locate( uint32_t hash, const char *key, size_t length ) const;
+        uint32_t find( uint32_t hash, const char *key, size_t length ) const;
+        uint32_t insert( uint32_t hash, const char *key, size_t length, uint16_t flags, const T &value );
+        void release( size_t slot );
+        void compact();
+        void grow();
+};
+
+
+template<typename T>
+SuffixTable<T>::SuffixTable() : released(0)
+{
+    clear();
+}
+
+
+template<typename T>
+SuffixTable<T>::~SuffixTable()
+{
+}
+
+
+template<typename T>
+uint32_t SuffixTable<T>::size() const
+{
+    return (uint32_t) (entries.size() - freed.size());
+}
+
+
+// upper bound of the rule ids (see 'walk')
+template<typename T>
+uint32_t SuffixTable<T>::limit() const
+{
+    return (uint32_t) (entries.size() + 1) * 2;
+}
+
+
+template<typename T>
+size_t SuffixTable<T>::memory() const
+{
+    return sizeof(Slot) * slots.size() + sizeof(SuffixEntry<T>) * entries.size() + keys.size() +
+        sizeof(SuffixTable<T>);
+}
+
+
+// FNV-1a, fed with the characters of the host name from right to left
+template<typename T>
+inline uint32_t SuffixTable<T>::hash( uint32_t current, char c )
+{
+    return (current ^ (uint8_t) c) * 16777619U;
+}
+
+
+/*
+ * Returns the index of the slot of the entry with the given key or the number
+ * of slots if there's no such entry.
+ */
+template<typename T>
+size_t SuffixTable<T>::locate( uint32_t hash, const char *key, size_t length ) const
+{
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash & mask; slots[i].entry != 0; i = (i + 1) & mask)
+    {
+        if (slots[i].hash != hash) continue;
+        const SuffixEntry<T> &entry = entries[slots[i].entry - 1];
+        if (entry.length == length && memcmp(keys.data() + entry.key, key, length) == 0)
+            return i;
+    }
+    return slots.size();
+}
+
+
+/*
+ * Returns the index plus one of the entry with the given key or zero if
+ * there's no such entry.
+ */
+template<typename T>
+uint32_t SuffixTable<T>::find( uint32_t hash, const char *key, size_t length ) const
+{
+    size_t i = locate(hash, key, length);
+    return (i < slots.size()) ? slots[i].entry : 0;
+}
+
+
+template<typename T>
+void SuffixTable<T>::grow()
+{
+    std::vector<Slot> current(slots.size() * 2);
+    size_t mask = current.size() - 1;
+    for (auto it = slots.begin(); it != slots.end(); ++it)
+    {
+        if (it->entry == 0) continue;
+        size_t i = it->hash & mask;
+        while (current[i].entry != 0) i = (i + 1) & mask;
+        current[i] = *it;
+    }
+    slots.swap(current);
+}
+
+
+template<typename T>
+int SuffixTable<T>::add( const std::string &target, const T &value, std::string *clean )
+{
+    return add(target.c_str(), target.length(), value, clean);
+}
+
+
+/*
+ * Same as above, but the rule is given as a span (e.g. in a mapped file).
+ */
+template<typename T>
+int SuffixTable<T>::add( const char *target, size_t length, const T &value, std::string *clean )
+{
+    if (target == nullptr || length == 0 || length > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < length; ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+    if (clean != nullptr) *clean = temp;
+
+    uint16_t flags = NODE_TERMINAL;
+    char *ptr = temp;
+    // '*' and '**' must precede a period
+    if (temp[0] == '*')
+    {
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            flags = NODE_TERMINAL | NODE_WILDCARD;
+            ptr += 3;
+        }
+        else
+        if (temp[1] == '.')
+        {
+            flags = NODE_WILDCARD;
+            ptr += 2;
+        }
+        else
+            return DNSBERR_INVALID_RULE;
+    }
+
+    // validate and lowercase the domain
+    length = strlen(ptr);
+    if (length == 0 || ptr[0] == '.' || ptr[length - 1] == '.') return DNSBERR_INVALID_ARGUMENT;
+    if (!normalizeHost(ptr, length, ptr, false)) return DNSBERR_INVALID_ARGUMENT;
+
+    // look for the domain and for wildcards covering it
+    uint32_t h = 2166136261U;
+    uint32_t entry = 0;
+    for (size_t i = length; i > 0; --i)
+    {
+        h = hash(h, ptr[i - 1]);
+        if (i - 1 == 0)
+            entry = find(h, ptr, length);
+        else
+        if (ptr[i - 2] == '.')
+        {
+            uint32_t parent = find(h, ptr + i - 1, length - i + 1);
+            if (parent != 0 && (entries[parent - 1].flags & NODE_WILDCARD))
+                return DNSBERR_DUPLICATED_RULE;
+        }
+    }
+
+    if (entry != 0)
+    {
+        SuffixEntry<T> &current = entries[entry - 1];
+        if ((current.flags & flags) == flags) return DNSBERR_DUPLICATED_RULE;
+        current.flags = (uint16_t) (current.flags | flags);
+        current.value = value;
+        return DNSBERR_OK;
+    }
+
+    insert(h, ptr, length, flags, value);
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Create the entry of a domain that is not in the table. Returns the index of
+ * the entry plus one.
+ */
+template<typename T>
+uint32_t SuffixTable<T>::insert( uint32_t hash, const char *key, size_t length, uint16_t flags, const T &value )
+{
+    if ((size() + 1) * 2 > slots.size()) grow();
+
+    SuffixEntry<T> current;
+    current.key = (uint32_t) keys.size();
+    current.length = (uint16_t) length;
+    current.flags = flags;
+    current.value = value;
+    keys.insert(keys.end(), key, key + length);
+    uint32_t entry;
+    if (!freed.empty())
+    {
+        entry = freed.back() + 1;
+        freed.pop_back();
+        entries[entry - 1] = current;
+    }
+    else
+    {
+        entries.push_back(current);
+        entry = (uint32_t) entries.size();
+    }
+
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i].entry != 0) i = (i + 1) & mask;
+    slots[i].hash = hash;
+    slots[i].entry = entry;
+
+    return entry;
+}
+
+
+/*
+ * Remove a rule added with 'add'. A '**' rule removes both the domain and the
+ * wildcard. Rules that were ignored by 'add' because a wildcard already
+ * covered them are not restored.
+ */
+template<typename T>
+int SuffixTable<T>::remove( const std::string &target )
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    uint16_t flags = NODE_TERMINAL;
+    char *ptr = temp;
+    if (temp[0] == '*')
+    {
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            flags = NODE_TERMINAL | NODE_WILDCARD;
+            ptr += 3;
+        }
+        else
+        if (temp[1] == '.')
+        {
+            flags = NODE_WILDCARD;
+            ptr += 2;
+        }
+        else
+            return DNSBERR_INVALID_RULE;
+    }
+
+    size_t length = strlen(ptr);
+    if (length == 0) return DNSBERR_INVALID_ARGUMENT;
+    if (!normalizeHost(ptr, length, ptr, false)) return DNSBERR_INVALID_ARGUMENT;
+    uint32_t h = 2166136261U;
+    for (size_t i = length; i > 0; --i) h = hash(h, ptr[i - 1]);
+
+    size_t i = locate(h, ptr, length);
+    if (i == slots.size()) return DNSBERR_MISSING_RULE;
+    SuffixEntry<T> &current = entries[slots[i].entry - 1];
+    if ((current.flags & flags) == 0) return DNSBERR_MISSING_RULE;
+    current.flags = (uint16_t) (current.flags & ~flags);
+    if (current.flags == 0) release(i);
+
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Release the entry in the given slot and close the gap in the probe sequence
+ * (backward shift).
+ */
+template<typename T>
+void SuffixTable<T>::release( size_t i )
+{
+    freed.push_back(slots[i].entry - 1);
+    released += entries[slots[i].entry - 1].length;
+    entries[slots[i].entry - 1] = SuffixEntry<T>();
+    size_t mask = slots.size() - 1;
+    for (size_t j = (i + 1) & mask; slots[j].entry != 0; j = (j + 1) & mask)
+    {
+        // the slot can move back unless its home lies between the gap and itself
+        size_t home = slots[j].hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].hash = 0;
+    slots[i].entry = 0;
+
+    // rules removed one by one (e.g. from the console) would otherwise grow the pool forever
+    if (released > keys.size() / 2) compact();
+}
+
+
+/*
+ * Rebuild the key pool with the keys of the entries in use. The entries stay
+ * in place, so the ids of the rules don't change.
+ */
+template<typename T>
+void SuffixTable<T>::compact()
+{
+    std::vector<char> current;
+    current.reserve(keys.size() - released);
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        // released entries are cleared
+        if (it->length == 0) continue;
+        uint32_t offset = (uint32_t) current.size();
+        current.insert(current.end(), keys.begin() + it->key, keys.begin() + it->key + it->length);
+        it->key = offset;
+    }
+    keys.swap(current);
+    released = 0;
+}
+
+
+/*
+ * Add a rule to a table of verdicts ('T' must be 'Verdict'). Unlike 'add',
+ * the given verdicts are merged into the ones the domain (or its subdomains,
+ * for wildcards) already has, so one table holds the rules of several lists.
+ * The rule is duplicated if the domain already has the verdicts, directly or
+ * through a wildcard (of the same categories). With VERDICT_FORWARD,
+ * 'upstream' is kept along with the verdict; with VERDICT_DENY, 'category' is
+ * added to the categories of the rule. If 'ids' is given, the ids (see
+ * 'walk') of the domain rule and of the wildcard rule are stored in 'ids[0]'
+ * and 'ids[1]' when the rule is created (i.e. it had no verdicts), so rules
+ * that only get another verdict keep their statistics.
+ */
+template<typename T>
+int SuffixTable<T>::mark( const std::string &target, uint8_t verdict, uint8_t upstream, std::string *clean,
+    uint32_t *ids, uint8_t category )
+{
+    return mark(target.c_str(), target.length(), verdict, upstream, clean, ids, category);
+}
+
+
+template<typename T>
+int SuffixTable<T>::mark( const char *target, size_t length, uint8_t verdict, uint8_t upstream, std::string *clean,
+    uint32_t *ids, uint8_t category )
+{
+    if (target == nullptr || length == 0 || length > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+    if (category >= VERDICT_CATEGORIES) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < length; ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+    if (clean != nullptr) *clean = temp;
+
+    uint16_t flags = NODE_TERMINAL;
+    char *ptr = temp;
+    // '*' and '**' must precede a period
+    if (temp[0] == '*')
+    {
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            flags = NODE_TERMINAL | NODE_WILDCARD;
+            ptr += 3;
+        }
+        else
+        if (temp[1] == '.')
+        {
+            flags = NODE_WILDCARD;
+            ptr += 2;
+        }
+        else
+            return DNSBERR_INVALID_RULE;
+    }
+
+    // validate and lowercase the domain
+    length = strlen(ptr);
+    if (length == 0 || ptr[0] == '.' || ptr[length - 1] == '.') return DNSBERR_INVALID_ARGUMENT;
+    if (!normalizeHost(ptr, length, ptr, false)) return DNSBERR_INVALID_ARGUMENT;
+
+    // look for the domain and for wildcards with the same verdicts covering it
+    uint16_t categories = (verdict & VERDICT_DENY) ? (uint16_t) (1U << category) : 0;
+    uint32_t h = 2166136261U;
+    uint32_t entry = 0;
+    for (size_t i = length; i > 0; --i)
+    {
+        h = hash(h, ptr[i - 1]);
+        if (i - 1 == 0)
+            entry = find(h, ptr, length);
+        else
+        if (ptr[i - 2] == '.')
+        {
+            uint32_t parent = find(h, ptr + i - 1, length - i + 1);
+            if (parent != 0 && (entries[parent - 1].flags & NODE_WILDCARD) &&
+                (entries[parent - 1].value.subdomains & verdict) == verdict &&
+                (entries[parent - 1].value.categories[1] & categories) == categories)
+                return DNSBERR_DUPLICATED_RULE;
+        }
+    }
+
+    if (entry == 0) entry = insert(h, ptr, length, 0, T());
+    SuffixEntry<T> &current = entries[entry - 1];
+    bool changed = false;
+    if ((flags & NODE_TERMINAL) && ((current.value.domain & verdict) != verdict ||
+        (current.value.categories[0] & categories) != categories))
+    {
+        if (ids != nullptr && current.value.domain == 0) ids[0] = entry * 2;
+        if ((verdict & VERDICT_FORWARD) && (current.value.domain & VERDICT_FORWARD) == 0)
+            current.value.upstream[0] = upstream;
+        current.value.domain = (uint8_t) (current.value.domain | verdict);
+        current.value.categories[0] = (uint16_t) (current.value.categories[0] | categories);
+        current.flags |= NODE_TERMINAL;
+        changed = true;
+    }
+    if ((flags & NODE_WILDCARD) && ((current.value.subdomains & verdict) != verdict ||
+        (current.value.categories[1] & categories) != categories))
+    {
+        if (ids != nullptr && current.value.subdomains == 0) ids[1] = entry * 2 + 1;
+        if ((verdict & VERDICT_FORWARD) && (current.value.subdomains & VERDICT_FORWARD) == 0)
+            current.value.upstream[1] = upstream;
+        current.value.subdomains = (uint8_t) (current.value.subdomains | verdict);
+        current.value.categories[1] = (uint16_t) (current.value.categories[1] | categories);
+        current.flags |= NODE_WILDCARD;
+        changed = true;
+    }
+
+    return (changed) ? DNSBERR_OK : DNSBERR_DUPLICATED_RULE;
+}
+
+
+/*
+ * Remove verdicts added with 'mark'. The rule is removed from the table once
+ * it has no verdicts left.
+ */
+template<typename T>
+int SuffixTable<T>::unmark( const std::string &target, uint8_t verdict )
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    uint16_t flags = NODE_TERMINAL;
+    char *ptr = temp;
+    if (temp[0] == '*')
+    {
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            flags = NODE_TERMINAL | NODE_WILDCARD;
+            ptr += 3;
+        }
+        else
+        if (temp[1] == '.')
+        {
+            flags = NODE_WILDCARD;
+            ptr += 2;
+        }
+        else
+            return DNSBERR_INVALID_RULE;
+    }
+
+    size_t length = strlen(ptr);
+    if (length == 0) return DNSBERR_INVALID_ARGUMENT;
+    if (!normalizeHost(ptr, length, ptr, false)) return DNSBERR_INVALID_ARGUMENT;
+    uint32_t h = 2166136261U;
+    for (size_t i = length; i > 0; --i) h = hash(h, ptr[i - 1]);
+
+    size_t i = locate(h, ptr, length);
+    if (i == slots.size()) return DNSBERR_MISSING_RULE;
+    SuffixEntry<T> &current = entries[slots[i].entry - 1];
+    bool changed = false;
+    if ((flags & NODE_TERMINAL) && (current.value.domain & verdict) != 0)
+    {
+        current.value.domain = (uint8_t) (current.value.domain & ~verdict);
+        if (verdict & VERDICT_DENY) current.value.categories[0] = 0;
+        if (current.value.domain == 0) current.flags &= (uint16_t) ~NODE_TERMINAL;
+        changed = true;
+    }
+    if ((flags & NODE_WILDCARD) && (current.value.subdomains & verdict) != 0)
+    {
+        current.value.subdomains = (uint8_t) (current.value.subdomains & ~verdict);
+        if (verdict & VERDICT_DENY) current.value.categories[1] = 0;
+        if (current.value.subdomains == 0) current.flags &= (uint16_t) ~NODE_WILDCARD;
+        changed = true;
+    }
+    if (!changed) return DNSBERR_MISSING_RULE;
+
+    // release the entry once the rule has no verdicts left
+    if (current.flags == 0) release(i);
+    return DNSBERR_OK;
+}
+
+
+template<typename T>
+const SuffixEntry<T> *SuffixTable<T>::match( const std::string &target ) const
+{
+    size_t length = target.length();
+    if (length == 0 || length > NODE_MAX_HOST_LENGTH) return nullptr;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1];
+    if (!normalizeHost(target.c_str(), length, temp, false)) return nullptr;
+
+    // probe every suffix that starts at a label boundary, shortest first
+    uint32_t h = 2166136261U;
+    for (size_t i = length; i > 0; --i)
+    {
+        h = hash(h, temp[i - 1]);
+
+        if (i - 1 == 0 || temp[i - 2] == '.')
+        {
+            uint32_t entry = find(h, temp + i - 1, length - i + 1);
+            if (entry == 0) continue;
+            const SuffixEntry<T> &current = entries[entry - 1];
+            if ((i - 1 == 0) ? (current.flags & NODE_TERMINAL) : (current.flags & NODE_WILDCARD))
+                return &current;
+        }
+    }
+
+    return nullptr;
+}
+
+
+/*
+ * Match a host name in DNS wire format (e.g. the QNAME of a received message)
+ * without building a string.
+ */
+template<typename T>
+const SuffixEntry<T> *SuffixTable<T>::match( const uint8_t *qname, size_t size ) const
+{
+    WireName name;
+    if (!name.read(qname, size)) return nullptr;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1];
+    size_t length = name.length;
+
+    uint32_t h = 2166136261U;
+    size_t i = length;
+    for (char c = name.next(); c != 0; --i)
+    {
+        temp[i - 1] = c;
+        h = hash(h, c);
+        c = name.next();
+
+        if (c == 0 || c == '.')
+        {
+            uint32_t entry = find(h, temp + i - 1, length - i + 1);
+            if (entry == 0) continue;
+            const SuffixEntry<T> &current = entries[entry - 1];
+            if ((c == 0) ? (current.flags & NODE_TERMINAL) : (current.flags & NODE_WILDCARD))
+                return &current;
+        }
+    }
+
+    return nullptr;
+}
+
+
+/*
+ * Visit the rules matching a host name in DNS wire format, from the top-level
+ * domain down. 'visitor' receives the value of each wildcard the name is below
+ * ('exact' is false) and then the value of the name itself, if it's a rule
+ * ('exact' is true), along with the id of the rule: twice the position of its
+ * entry, plus one for wildcards, which doesn't change while the rule exists
+ * and is below 'limit'.
+ */
+template<typename T>
+template<typename F>
+void SuffixTable<T>::walk( const uint8_t *qname, size_t size, F visitor ) const
+{
+    WireName name;
+    if (!name.read(qname, size)) return;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1];
+    size_t length = name.length;
+
+    uint32_t h = 2166136261U;
+    size_t i = length;
+    for (char c = name.next(); c != 0; --i)
+    {
+        temp[i - 1] = c;
+        h = hash(h, c);
+        c = name.next();
+
+        if (c == 0 || c == '.')
+        {
+            uint32_t entry = find(h, temp + i - 1, length - i + 1);
+            if (entry == 0) continue;
+            const SuffixEntry<T> &current = entries[entry - 1];
+            if (c == 0)
+            {
+                if (current.flags & NODE_TERMINAL) visitor(current.value, true, entry * 2);
+            }
+            else
+            if (current.flags & NODE_WILDCARD)
+                visitor(current.value, false, entry * 2 + 1);
+        }
+    }
+}
+
+
+/*
+ * Find the rules named by 'target', as given to 'mark' (a '**' rule names the
+ * domain and the wildcard). 'visitor' receives the value, whether it's the
+ * domain rule and the id of each one in the table (see 'walk').
+ */
+template<typename T>
+template<typename F>
+int SuffixTable<T>::visit( const std::string &target, F visitor ) const
+{
+    if (target.empty() || target.length() > NODE_MAX_HOST_LENGTH) return DNSBERR_INVALID_ARGUMENT;
+
+    char temp[NODE_MAX_HOST_LENGTH + 1] = { 0 };
+    // copy ignoring leading and trailing whitespaces
+    for (size_t i = 0, j = 0; j < target.length(); ++j)
+    {
+        if (target[j] != ' ' && target[j] != '\t')
+            temp[i++] = target[j];
+        else
+        {
+            if (temp[0] != 0) break;
+        }
+    }
+
+    uint16_t flags = NODE_TERMINAL;
+    char *ptr = temp;
+    if (temp[0] == '*')
+    {
+        if (temp[1] == '*' && temp[2] == '.')
+        {
+            flags = NODE_TERMINAL | NODE_WILDCARD;
+            ptr += 3;
+        }
+        else
+        if (temp[1] == '.')
+        {
+            flags = NODE_WILDCARD;
+            ptr += 2;
+        }
+        else
+            return DNSBERR_INVALID_RULE;
+    }
+
+    size_t length = strlen(ptr);
+    if (length == 0) return DNSBERR_INVALID_ARGUMENT;
+    if (!normalizeHost(ptr, length, ptr, false)) return DNSBERR_INVALID_ARGUMENT;
+    uint32_t h = 2166136261U;
+    for (size_t i = length; i > 0; --i) h = hash(h, ptr[i - 1]);
+
+    uint32_t entry = find(h, ptr, length);
+    if (entry == 0 || (entries[entry - 1].flags & flags) == 0) return DNSBERR_MISSING_RULE;
+    const SuffixEntry<T> &current = entries[entry - 1];
+    if (flags & current.flags & NODE_TERMINAL) visitor(current.value, true, entry * 2);
+    if (flags & current.flags & NODE_WILDCARD) visitor(current.value, false, entry * 2 + 1);
+    return DNSBERR_OK;
+}
+
+
+/*
+ * Visit every rule of the table. 'visitor' receives the id of the rule (see
+ * 'walk'), the rule as it would be written in a list ('*.' for wildcards) and
+ * its value.
+ */
+template<typename T>
+template<typename F>
+void SuffixTable<T>::rules( F visitor ) const
+{
+    std::string rule;
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const SuffixEntry<T> &entry = entries[i];
+        if (entry.flags & NODE_TERMINAL)
+        {
+            rule.assign(keys.data() + entry.key, entry.length);
+            visitor((uint32_t) (i + 1) * 2, rule, entry.value);
+        }
+        if (entry.flags & NODE_WILDCARD)
+        {
+            rule.assign("*.");
+            rule.append(keys.data() + entry.key, entry.length);
+            visitor((uint32_t) (i + 1) * 2 + 1, rule, entry.value);
+        }
+    }
+}
+
+
+/*
+ * Collect the shape of the table (see 'TreeProfile'). Entries have no
+ * children, so only the depth histogram is filled.
+ */
+template<typename T>
+void SuffixTable<T>::profile( TreeProfile &profile ) const
+{
+    profile = TreeProfile();
+    profile.memory = memory();
+
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it->flags == 0) continue;
+        ++profile.nodes;
+        ++profile.domains;
+        profile.keys += it->length;
+
+        size_t depth = 1;
+        for (uint16_t i = 0; i < it->length; ++i)
+            if (keys[it->key + i] == '.') ++depth;
+        for (uint16_t flag = NODE_TERMINAL; flag <= NODE_WILDCARD; flag = (uint16_t) (flag << 1))
+        {
+            if ((it->flags & flag) == 0) continue;
+            ++profile.rules;
+            ++profile.depth[std::min<size_t>(depth, PROFILE_BUCKETS) - 1];
+        }
+    }
+
+    profile.wasted = sizeof(SuffixEntry<T>) * freed.size() + keys.size() - profile.keys;
+}
+
+
+template<typename T>
+void SuffixTable<T>::clear()
+{
+    slots.clear();
+    slots.resize(1024);
+    entries.clear();
+    freed.clear();
+    keys.clear();
+    released = 0;
+}
+
+
+#endif // DNSB_SUFFIX_HH
@@ -0,0 +1,684 @@
+#include "nodes.hh"
+#include "glob.hh"
+#include "keyword.hh"
+#include "radix.hh"
+#include "suffix.hh"
+#include "stats.hh"
+#include "policy.hh"
+#include "heuristic.hh"
+#include "dns.hh"
+#include <dns-blocker/errors.hh>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+using namespace dnsblocker;
+
+
+static int failures = 0;
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expression); \
+            ++failures; \
+        } \
+    } while (false)
+
+
+/*
+ * Encode a host name in DNS wire format, like the QNAME of a query.
+ */
+static std::string makeWireName( const std::string &host )
+{
+    std::string output;
+    size_t start = 0;
+    while (start < host.length())
+    {
+        size_t end = host.find('.', start);
+        if (end == std::string::npos) end = host.length();
+        output += (char) (end - start);
+        output += host.substr(start, end - start);
+        start = end + 1;
+    }
+    output += '\0';
+    return output;
+}
+
+
+// verdicts of the patterns for a host name, checking that both forms of the name agree
+static uint8_t matchGlob( const GlobRules &rules, const std::string &host )
+{
+    std::string wire = makeWireName(host);
+    uint8_t verdict = rules.match(host);
+    CHECK(rules.match((const uint8_t*) wire.data(), wire.size()) == verdict);
+    return verdict;
+}
+
+
+static void testGlobs()
+{
+    GlobRules rules;
+    CHECK(rules.add("ads*.example.com", VERDICT_DENY) == DNSBERR_OK);
+    CHECK(rules.add("*.cdn*.example.net", VERDICT_DENY) == DNSBERR_OK);
+    CHECK(rules.add("**.track*.example.org", VERDICT_DENY) == DNSBERR_OK);
+    CHECK(rules.add("*-tracker.*.net", VERDICT_DENY) == DNSBERR_OK);
+    CHECK(rules.add("ads*good.example.com", VERDICT_ALLOW) == DNSBERR_OK);
+    CHECK(rules.add("ADS**.example.com", VERDICT_DENY) == DNSBERR_DUPLICATED_RULE);
+    CHECK(rules.add("example.com", VERDICT_DENY) == DNSBERR_INVALID_RULE);
+    CHECK(rules.add("ads*.", VERDICT_DENY) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(rules.add("ads*!.com", VERDICT_DENY) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(rules.compile());
+    CHECK(rules.size() == 5);
+
+    // an asterisk matches any run of characters within a label, even an empty one
+    CHECK(matchGlob(rules, "ads.example.com") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "ads-1.example.com") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "ADS1.Example.COM") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "ads.x.example.com") == 0);
+    CHECK(matchGlob(rules, "x.ads1.example.com") == 0);
+    CHECK(matchGlob(rules, "bads.example.com") == 0);
+    CHECK(matchGlob(rules, "adsgood.example.com") == (VERDICT_DENY | VERDICT_ALLOW));
+    CHECK(matchGlob(rules, "ads-so-good.example.com") == (VERDICT_DENY | VERDICT_ALLOW));
+
+    // '*.' only matches subdomains
+    CHECK(matchGlob(rules, "img.cdn1.example.net") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "a.b.cdn.example.net") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "cdn1.example.net") == 0);
+
+    // '**.' matches the domain and its subdomains
+    CHECK(matchGlob(rules, "tracker.example.org") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "a.tracking.example.org") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "a.b.track.example.org") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "atrack.example.org") == 0);
+    CHECK(matchGlob(rules, "track.example.org.br") == 0);
+
+    CHECK(matchGlob(rules, "my-tracker.anything.net") == VERDICT_DENY);
+    CHECK(matchGlob(rules, "my-tracker.net") == 0);
+    CHECK(matchGlob(rules, "-tracker.a.net") == VERDICT_DENY);
+
+    // removed patterns only stop matching once compiled again
+    CHECK(rules.remove("ads*.example.com", VERDICT_DENY) == DNSBERR_OK);
+    CHECK(rules.remove("ads*.example.com", VERDICT_DENY) == DNSBERR_MISSING_RULE);
+    CHECK(matchGlob(rules, "ads1.example.com") == VERDICT_DENY);
+    CHECK(rules.compile());
+    CHECK(matchGlob(rules, "ads1.example.com") == 0);
+    CHECK(matchGlob(rules, "adsgood.example.com") == VERDICT_ALLOW);
+
+    CHECK(GlobRules::isPattern("ads*.example.com"));
+    CHECK(GlobRules::isPattern("  *.ads*.example.com  "));
+    CHECK(!GlobRules::isPattern("**.example.com"));
+    CHECK(!GlobRules::isPattern("*.example.com # comment*"));
+}
+
+
+// verdicts of the keywords for a host name, checking that both forms of the name agree
+static uint8_t matchKeywords( const KeywordRules &rules, const std::string &host )
+{
+    std::string wire = makeWireName(host);
+    uint8_t verdict = rules.match(host);
+    CHECK(rules.match((const uint8_t*) wire.data(), wire.size()) == verdict);
+    return verdict;
+}
+
+
+static void testKeywords()
+{
+    KeywordRules rules;
+    rules.compile();
+    CHECK(matchKeywords(rules, "example.com") == 0);
+
+    // keywords that overlap, contain each other or share prefixes and suffixes
+    CHECK(rules.add("ads") == DNSBERR_OK);
+    CHECK(rules.add("adserver") == DNSBERR_OK);
+    CHECK(rules.add("serve") == DNSBERR_OK);
+    CHECK(rules.add("track") == DNSBERR_OK);
+    CHECK(rules.add("racket") == DNSBERR_OK);
+    CHECK(rules.add("abab") == DNSBERR_OK);
+    CHECK(rules.add("\tTelemetry ") == DNSBERR_OK);
+    CHECK(rules.add("telemetry") == DNSBERR_DUPLICATED_RULE);
+    CHECK(rules.add("bad!") == DNSBERR_INVALID_RULE);
+    CHECK(rules.add("  ") == DNSBERR_INVALID_ARGUMENT);
+    rules.compile();
+    CHECK(rules.size() == 7);
+
+    CHECK(matchKeywords(rules, "ads.example.com") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "myadserver.net") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "observer.net") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "tracket.com") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "xracket.com") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "aabab.org") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "ababab.org") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "TELEMETRY.example.com") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "a.b.c.telemetry") == VERDICT_DENY);
+
+    // partial matches, also across the periods
+    CHECK(matchKeywords(rules, "ad.example.com") == 0);
+    CHECK(matchKeywords(rules, "ad.s.example.com") == 0);
+    CHECK(matchKeywords(rules, "serv.example.com") == 0);
+    CHECK(matchKeywords(rules, "trac.k.com") == 0);
+    CHECK(matchKeywords(rules, "rackets.com") == VERDICT_DENY);
+    CHECK(matchKeywords(rules, "aba.b.org") == 0);
+    CHECK(matchKeywords(rules, "telemetr.y") == 0);
+
+    rules.clear();
+    rules.compile();
+    CHECK(matchKeywords(rules, "ads.example.com") == 0);
+}
+
+
+// id of the rule matching a host name (the domain itself, or a wildcard if 'exact' is false)
+template<typename R>
+static uint32_t findRule( const R &tree, const std::string &host, bool exact )
+{
+    std::string wire = makeWireName(host);
+    uint32_t output = 0;
+    tree.walk((const uint8_t*) wire.data(), wire.size(), [&output, exact]( const Verdict &, bool current, uint32_t id )
+    {
+        if (current == exact) output = id;
+    });
+    return output;
+}
+
+
+// ids reported by 'mark' in both rule trees
+template<typename R>
+static void testRuleIds()
+{
+    R tree;
+    uint32_t ids[2] = { 0, 0 };
+    CHECK(tree.mark("example.com", VERDICT_DENY, 0, nullptr, ids) == DNSBERR_OK);
+    CHECK(ids[0] != 0 && ids[1] == 0);
+    CHECK(findRule(tree, "example.com", true) == ids[0]);
+    uint32_t domain = ids[0];
+
+    // another verdict for an existing rule keeps its id, and reports none
+    ids[0] = ids[1] = 0;
+    CHECK(tree.mark("example.com", VERDICT_ALLOW, 0, nullptr, ids) == DNSBERR_OK);
+    CHECK(ids[0] == 0 && ids[1] == 0);
+    CHECK(tree.mark("example.com", VERDICT_ALLOW, 0, nullptr, ids) == DNSBERR_DUPLICATED_RULE);
+    CHECK(findRule(tree, "example.com", true) == domain);
+
+    // '**' creates the domain and the wildcard
+    CHECK(tree.mark("**.tracker.net", VERDICT_DENY, 0, nullptr, ids) == DNSBERR_OK);
+    CHECK(ids[0] != 0 && ids[1] != 0 && ids[0] != ids[1] && ids[0] != domain && ids[1] != domain);
+    CHECK(findRule(tree, "tracker.net", true) == ids[0]);
+    CHECK(findRule(tree, "a.b.tracker.net", false) == ids[1]);
+    uint32_t wildcard = ids[1];
+    ids[0] = ids[1] = 0;
+    CHECK(tree.mark("*.tracker.net", VERDICT_ALLOW, 0, nullptr, ids) == DNSBERR_OK);
+    CHECK(ids[0] == 0 && ids[1] == 0);
+    CHECK(findRule(tree, "a.tracker.net", false) == wildcard);
+
+    // a rule without verdicts is created again
+    CHECK(tree.unmark("example.com", VERDICT_DENY) == DNSBERR_OK);
+    CHECK(tree.unmark("example.com", VERDICT_ALLOW) == DNSBERR_OK);
+    CHECK(tree.unmark("example.com", VERDICT_ALLOW) == DNSBERR_MISSING_RULE);
+    CHECK(findRule(tree, "example.com", true) == 0);
+    CHECK(tree.mark("example.com", VERDICT_ALLOW, 0, nullptr, ids) == DNSBERR_OK);
+    CHECK(ids[0] != 0 && ids[1] == 0);
+    CHECK(ids[0] < tree.limit());
+}
+
+
+static void testStats()
+{
+    testRuleIds< RadixTree<Verdict> >();
+    testRuleIds< SuffixTable<Verdict> >();
+
+    RuleStats stats;
+    stats.resize(8);
+    uint32_t source = stats.source("rules.txt");
+    CHECK(stats.source("rules.txt") == source);
+    stats.origin(3, source, 7);
+    stats.origin(3, stats.source("other.txt"), 1);
+    CHECK(stats.origin(3) == "rules.txt:7");
+    CHECK(stats.origin(4) == "unknown");
+    stats.hit(3);
+    stats.hit(3);
+    stats.hit(100);
+    CHECK(stats.hits(3) == 2);
+    CHECK(stats.hits(100) == 0);
+
+    // a copy keeps the origins and counts from zero until the counters are merged
+    RuleStats copy(stats);
+    copy.resize(16);
+    CHECK(copy.origin(3) == "rules.txt:7");
+    CHECK(copy.hits(3) == 0);
+    copy.hit(3);
+    copy.hit(12);
+    stats.hit(3);
+    copy.merge(stats);
+    CHECK(copy.hits(3) == 4);
+    CHECK(copy.hits(12) == 1);
+
+    // a rule created with the id of a removed one starts over
+    copy.reset(3, copy.source("console"), 0);
+    CHECK(copy.hits(3) == 0);
+    CHECK(copy.origin(3) == "console");
+    CHECK(stats.hits(3) == 3);
+}
+
+
+// address in host byte order
+static uint32_t makeIPv4( int o1, int o2, int o3, int o4 )
+{
+    return ((uint32_t) o1 << 24) | ((uint32_t) o2 << 16) | ((uint32_t) o3 << 8) | (uint32_t) o4;
+}
+
+
+static void testPolicies()
+{
+    PolicyTable table;
+    CHECK(table.find(makeIPv4(10, 1, 2, 3)) == 0);
+    table.build();
+    CHECK(table.find(makeIPv4(10, 1, 2, 3)) == 0);
+
+    // nested subnets, added in any order (the longest prefix wins)
+    CHECK(table.add("10.1.2.3", 4) == DNSBERR_OK);
+    CHECK(table.add("10.1.0.0/16", 2) == DNSBERR_OK);
+    CHECK(table.add("10.0.0.0/8", 1) == DNSBERR_OK);
+    CHECK(table.add("10.1.2.0/24", 3) == DNSBERR_OK);
+    CHECK(table.add("10.200.7.0/24", 5) == DNSBERR_OK);
+    CHECK(table.add("192.168.1.128/25", 6) == DNSBERR_OK);
+    CHECK(table.add("10.1.2.99/24", 1) == DNSBERR_DUPLICATED_RULE);
+    CHECK(table.add("10.1.2.3/32", 1) == DNSBERR_DUPLICATED_RULE);
+    CHECK(table.add("10.1.2.0/24", 0) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(table.add("10.1.2/24", 1) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(table.add("10.1.2.256", 1) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(table.add("10.1.2.0/33", 1) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(table.add("10.1.2.0/", 1) == DNSBERR_INVALID_ARGUMENT);
+    CHECK(table.size() == 6);
+    table.build();
+
+    CHECK(table.find(makeIPv4(10, 1, 2, 3)) == 4);
+    CHECK(table.find(makeIPv4(10, 1, 2, 2)) == 3);
+    CHECK(table.find(makeIPv4(10, 1, 2, 4)) == 3);
+    CHECK(table.find(makeIPv4(10, 1, 2, 255)) == 3);
+    CHECK(table.find(makeIPv4(10, 1, 3, 3)) == 2);
+    CHECK(table.find(makeIPv4(10, 1, 255, 255)) == 2);
+    CHECK(table.find(makeIPv4(10, 2, 2, 3)) == 1);
+    CHECK(table.find(makeIPv4(10, 0, 0, 0)) == 1);
+    CHECK(table.find(makeIPv4(10, 255, 255, 255)) == 1);
+    CHECK(table.find(makeIPv4(10, 200, 7, 1)) == 5);
+    CHECK(table.find(makeIPv4(10, 200, 8, 1)) == 1);
+    CHECK(table.find(makeIPv4(11, 1, 2, 3)) == 0);
+    CHECK(table.find(makeIPv4(9, 255, 255, 255)) == 0);
+    CHECK(table.find(makeIPv4(192, 168, 1, 128)) == 6);
+    CHECK(table.find(makeIPv4(192, 168, 1, 255)) == 6);
+    CHECK(table.find(makeIPv4(192, 168, 1, 127)) == 0);
+
+    // the whole address space
+    CHECK(table.add("0.0.0.0/0", 7) == DNSBERR_OK);
+    table.build();
+    CHECK(table.find(makeIPv4(11, 1, 2, 3)) == 7);
+    CHECK(table.find(makeIPv4(10, 1, 2, 3)) == 4);
+    CHECK(table.find(makeIPv4(192, 168, 1, 127)) == 7);
+
+    table.clear();
+    table.build();
+    CHECK(table.find(makeIPv4(10, 1, 2, 3)) == 0);
+}
+
+
+static bool isRandom( const RandomDomainModel &model, const std::string &host )
+{
+    std::string wire = makeWireName(host);
+    return model.isRandom((const uint8_t*) wire.data(), wire.size());
+}
+
+
+static void testHeuristics()
+{
+    // without a model, labels with digits or few vowels are random
+    RandomDomainModel model;
+    CHECK(model.empty());
+    CHECK(isRandom(model, "x7k2q9zt4p.com"));
+    CHECK(isRandom(model, "bcdfghjklmnp.com"));
+    CHECK(isRandom(model, "www.bcdfghjklmnp.com"));
+    CHECK(!isRandom(model, "information.com"));
+    CHECK(!isRandom(model, "x7k2q9zt4.com"));
+    CHECK(!isRandom(model, "bcdfghjklmnp"));
+    CHECK(!isRandom(model, "bcdfghjklmnp.sub.example.com"));
+    CHECK(isRandom(model, "d1x2y3z4w5q6.cloudfront.net"));
+
+    // a model trained with names made of a few syllables
+    static const char *SYLLABLES[] = { "kan", "tor", "mel", "sin", "dar", "lop", "ver", "bis", "pon", "gat",
+        "ruf", "hem" };
+    RandomDomainTrainer trainer;
+    for (size_t i = 0; i < 12 * 12 * 12; ++i)
+    {
+        trainer.add(std::string(SYLLABLES[i % 12]) + SYLLABLES[i / 12 % 12] + SYLLABLES[i / 144] +
+            SYLLABLES[(i * 7) % 12] + ".com");
+    }
+    trainer.add("com");
+    trainer.add("a.b!c.com");
+    CHECK(trainer.size() == 12 * 12 * 12 + 1);
+    CHECK(trainer.train(model));
+    CHECK(!model.empty());
+
+    CHECK(!isRandom(model, "sinverpongat.com"));
+    CHECK(!isRandom(model, "www.hemrufkantor.net"));
+    CHECK(!isRandom(model, "qzxwvjkfp.com"));
+    CHECK(isRandom(model, "qzxwvjkfpq.com"));
+    CHECK(isRandom(model, "kantorzzzzmel.com"));
+
+    // the model is the same once saved and loaded
+    RandomDomainModel loaded;
+    const char *path = "tests.model";
+    CHECK(model.save(path));
+    CHECK(loaded.load(path));
+    remove(path);
+    CHECK(loaded.samples() == model.samples());
+    CHECK(loaded.threshold() == model.threshold());
+    CHECK(!isRandom(loaded, "sinverpongat.com"));
+    CHECK(isRandom(loaded, "kantorzzzzmel.com"));
+    CHECK(!loaded.load(path));
+}
+
+
+// query in wire format with the given header fields and question, optionally followed by an OPT record
+static std::string makeQuery( const std::string &host, uint16_t type, uint16_t flags = DNS_FLAG_RD,
+    uint16_t qdcount = 1, int udpSize = 0 )
+{
+    std::string output;
+    const uint16_t header[] = { 0x1234, flags, qdcount, 0, 0, (uint16_t) ((udpSize > 0) ? 1 : 0) };
+    for (size_t i = 0; i < 6; ++i)
+    {
+        output += (char) (header[i] >> 8);
+        output += (char) header[i];
+    }
+    output += makeWireName(host);
+    output += (char) (type >> 8);
+    output += (char) type;
+    output += std::string("\0\1", 2);
+    if (udpSize > 0)
+    {
+        output += std::string("\0\0\x29", 3);
+        output += (char) (udpSize >> 8);
+        output += (char) udpSize;
+        output += std::string("\0\0\x80\0\0\0", 6);
+    }
+    return output;
+}
+
+
+static bool readQuery( dns_message_view &view, const std::string &data )
+{
+    return view.read((const uint8_t*) data.data(), data.size());
+}
+
+
+static void testQueries()
+{
+    dns_message_view view;
+    std::string query = makeQuery("www.Example.com", DNS_TYPE_AAAA);
+    CHECK(readQuery(view, query));
+    CHECK(view.id == 0x1234);
+    CHECK(view.qdcount == 1);
+    CHECK(view.qtype == DNS_TYPE_AAAA);
+    CHECK(view.qclass == 1);
+    CHECK(view.qnameOffset == DNS_HEADER_SIZE);
+    CHECK(view.qnameSize == 17);
+    CHECK(view.length == 15);
+    CHECK(view.labels == 3);
+    CHECK(view.questionEnd() == query.size());
+    CHECK(view.udpSize == DNS_UDP_SIZE);
+    CHECK(!view.edns);
+    char name[DNS_NAME_SIZE];
+    CHECK(view.name(name) == 15 && strcmp(name, "www.example.com") == 0);
+
+    // the root domain
+    CHECK(readQuery(view, makeQuery("", DNS_TYPE_NS)));
+    CHECK(view.qnameSize == 1 && view.length == 0 && view.labels == 0);
+
+    // EDNS, which never lowers the UDP payload size
+    CHECK(readQuery(view, makeQuery("example.com", DNS_TYPE_TXT, DNS_FLAG_RD, 1, 1232)));
+    CHECK(view.edns && view.udpSize == 1232);
+    CHECK(readQuery(view, makeQuery("example.com", DNS_TYPE_TXT, DNS_FLAG_RD, 1, 100)));
+    CHECK(view.edns && view.udpSize == DNS_UDP_SIZE);
+    CHECK(readQuery(view, makeQuery("example.com", DNS_TYPE_TXT, DNS_FLAG_RD, 2, 1232) + query.substr(12)));
+    CHECK(!view.edns && view.udpSize == DNS_UDP_SIZE);
+
+    // malformed messages
+    CHECK(!view.read(nullptr, 0));
+    CHECK(!readQuery(view, query.substr(0, DNS_HEADER_SIZE - 1)));
+    CHECK(!readQuery(view, query.substr(0, DNS_HEADER_SIZE)));
+    CHECK(!readQuery(view, query.substr(0, DNS_HEADER_SIZE + 5)));
+    CHECK(!readQuery(view, query.substr(0, DNS_HEADER_SIZE + 16)));
+    CHECK(!readQuery(view, query.substr(0, query.size() - 1)));
+    CHECK(!readQuery(view, makeQuery("example.com", DNS_TYPE_A, DNS_FLAG_QR | DNS_FLAG_RD)));
+    CHECK(!readQuery(view, makeQuery("example.com", DNS_TYPE_A, DNS_FLAG_RD, 0)));
+
+    // compression pointers, even to the QNAME itself
+    std::string pointer = makeQuery("example.com", DNS_TYPE_A);
+    pointer.replace(DNS_HEADER_SIZE + 8, 5, std::string("\xC0\x0C\0\0\1", 5));
+    CHECK(!readQuery(view, pointer));
+
+    // labels longer than the packet and names longer than 255 bytes
+    std::string label = query;
+    label[DNS_HEADER_SIZE + 4] = 60;
+    CHECK(!readQuery(view, label));
+    std::string host;
+    for (int i = 0; i < 4; ++i) host += std::string(63, 'a') + ".";
+    CHECK(!readQuery(view, makeQuery(host + "com", DNS_TYPE_A)));
+    host.resize(host.size() - 6);
+    CHECK(readQuery(view, makeQuery(host + "com", DNS_TYPE_A)));
+    CHECK(view.qnameSize == DNS_NAME_SIZE);
+}
+
+
+namespace dnsblocker {
+
+struct DNSCacheTest
+{
+    static void store( DNSCache &cache, const std::string &key, uint32_t now, const std::string &data )
+    {
+        std::lock_guard<std::mutex> raii(cache.lock_);
+        cache.store(key, now, (const uint8_t*) data.data(), data.size());
+    }
+
+    // the response as a client would receive it (empty if not found)
+    static std::string find( DNSCache &cache, const std::string &key, uint32_t now, const std::string &query )
+    {
+        dns_message_view request;
+        if (!request.read((const uint8_t*) query.data(), query.size())) return "";
+        uint8_t output[DNS_PACKET_SIZE];
+        size_t size = 0;
+        std::lock_guard<std::mutex> raii(cache.lock_);
+        if (!cache.find(key, now, request, output, &size)) return "";
+        return std::string((const char*) output, size);
+    }
+};
+
+}
+
+
+struct Record
+{
+    uint16_t type;
+    uint32_t ttl;
+    std::string rdata;
+};
+
+
+static void writeU16( std::string &output, size_t offset, uint16_t value )
+{
+    output[offset] = (char) (value >> 8);
+    output[offset + 1] = (char) value;
+}
+
+
+static uint32_t readU32( const std::string &data, size_t offset )
+{
+    return ((uint32_t) (uint8_t) data[offset] << 24) | ((uint32_t) (uint8_t) data[offset + 1] << 16) |
+        ((uint32_t) (uint8_t) data[offset + 2] << 8) | (uint8_t) data[offset + 3];
+}
+
+
+/*
+ * Response to a query (see 'makeQuery') with the given records, all named
+ * after the QNAME. The first 'answers' records are answers and the others
+ * are in the authority section, followed by an OPT record if 'edns' is true.
+ */
+static std::string makeResponse( const std::string &query, int rcode, const std::vector<Record> &records,
+    size_t answers, bool edns )
+{
+    dns_message_view view;
+    view.read((const uint8_t*) query.data(), query.size());
+    std::string output = query.substr(0, view.questionEnd());
+    writeU16(output, 2, (uint16_t) (DNS_FLAG_QR | DNS_FLAG_RD | DNS_FLAG_RA | rcode));
+    writeU16(output, 6, (uint16_t) answers);
+    writeU16(output, 8, (uint16_t) (records.size() - answers));
+    writeU16(output, 10, (uint16_t) ((edns) ? 1 : 0));
+    for (auto it = records.begin(); it != records.end(); ++it)
+    {
+        std::string record("\xC0\x0C\0\0\0\1\0\0\0\0\0\0", 12);
+        writeU16(record, 2, it->type);
+        writeU16(record, 6, (uint16_t) (it->ttl >> 16));
+        writeU16(record, 8, (uint16_t) it->ttl);
+        writeU16(record, 10, (uint16_t) it->rdata.size());
+        output += record + it->rdata;
+    }
+    if (edns) output += std::string("\0\0\x29\x04\xD0\0\0\0\0\0\0", 11);
+    return output;
+}
+
+
+// SOA record with the given TTL and MINIMUM field
+static Record makeSOA( uint32_t ttl, uint32_t minimum )
+{
+    std::string rdata("\x02ns\xC0\x0C\x04host\xC0\x0C", 12);
+    for (int i = 0; i < 5; ++i)
+    {
+        uint32_t value = (i < 4) ? (uint32_t) i + 1 : minimum;
+        rdata += std::string("\0\0\0\0", 4);
+        writeU16(rdata, rdata.size() - 4, (uint16_t) (value >> 16));
+        writeU16(rdata, rdata.size() - 2, (uint16_t) value);
+    }
+    return Record{ DNS_TYPE_SOA, ttl, rdata };
+}
+
+
+static void testCache()
+{
+    DNSCache cache(10, 600);
+    std::string query = makeQuery("Example.com", DNS_TYPE_TXT);
+    const std::vector<Record> records = { { DNS_TYPE_TXT, 300, "\x05hello" }, { DNS_TYPE_TXT, 100, "\x03bye" } };
+    std::string response = makeResponse(query, DNS_RCODE_NOERROR, records, 2, true);
+    DNSCacheTest::store(cache, "example.com/16", 1000, response);
+
+    // the TTLs are decremented by the time spent in the cache
+    std::string other = makeQuery("EXAMPLE.com", DNS_TYPE_TXT);
+    other[0] = 0x56;
+    std::string output = DNSCacheTest::find(cache, "example.com/16", 1030, other);
+    size_t first = other.size() + 6;
+    size_t second = first + 18;
+    CHECK(output.size() == response.size() - DNS_OPT_SIZE);
+    CHECK(output.compare(0, 2, other, 0, 2) == 0);
+    CHECK(output.compare(DNS_HEADER_SIZE, 13, other, DNS_HEADER_SIZE, 13) == 0);
+    CHECK(readU32(output, first) == 270);
+    CHECK(readU32(output, second) == 70);
+    CHECK(output[10] == 0 && output[11] == 0);
+    CHECK(DNSCacheTest::find(cache, "example.com/16", 1099, other).size() == output.size());
+    CHECK(DNSCacheTest::find(cache, "example.com/16", 1100, other).empty());
+
+    // requests with EDNS get an OPT record of our own, with their DO bit
+    std::string edns = makeQuery("example.com", DNS_TYPE_TXT, DNS_FLAG_RD, 1, 4096);
+    output = DNSCacheTest::find(cache, "example.com/16", 1000, edns);
+    CHECK(output.size() == response.size());
+    CHECK(output[11] == 1);
+    CHECK(output.compare(output.size() - DNS_OPT_SIZE, 3, std::string("\0\0\x29", 3)) == 0);
+    CHECK(output[output.size() - 8] == (char) (DNS_BUFFER_SIZE >> 8));
+    CHECK(output[output.size() - 7] == (char) DNS_BUFFER_SIZE);
+    CHECK(output[output.size() - 4] == (char) 0x80);
+
+    // responses larger than the client accepts are truncated
+    std::string big = makeResponse(query, DNS_RCODE_NOERROR, { { DNS_TYPE_TXT, 300, std::string(600, 'x') } },
+        1, false);
+    DNSCacheTest::store(cache, "big.com/16", 1000, big);
+    output = DNSCacheTest::find(cache, "big.com/16", 1000, query);
+    CHECK(output.size() == query.size() && (output[2] & (DNS_FLAG_TC >> 8)) != 0);
+    CHECK(DNSCacheTest::find(cache, "big.com/16", 1000, edns).size() == big.size() + DNS_OPT_SIZE);
+
+    // negative answers last for the smallest of the TTL and the MINIMUM field of the SOA record
+    DNSCacheTest::store(cache, "nx.com/16", 1000, makeResponse(query, DNS_RCODE_NXDOMAIN, { makeSOA(3600, 60) },
+        0, false));
+    CHECK(!DNSCacheTest::find(cache, "nx.com/16", 1059, query).empty());
+    CHECK(DNSCacheTest::find(cache, "nx.com/16", 1060, query).empty());
+    DNSCacheTest::store(cache, "nodata.com/16", 1000, makeResponse(query, DNS_RCODE_NOERROR, { makeSOA(30, 60) },
+        0, false));
+    CHECK(!DNSCacheTest::find(cache, "nodata.com/16", 1029, query).empty());
+    CHECK(DNSCacheTest::find(cache, "nodata.com/16", 1030, query).empty());
+
+    // the cache TTL limits every response; truncated responses and failures are not kept
+    DNSCacheTest::store(cache, "long.com/16", 2000, makeResponse(query, DNS_RCODE_NOERROR,
+        { { DNS_TYPE_TXT, 86400, "\x01x" } }, 1, false));
+    CHECK(!DNSCacheTest::find(cache, "long.com/16", 2599, query).empty());
+    CHECK(DNSCacheTest::find(cache, "long.com/16", 2600, query).empty());
+    std::string truncated = response;
+    truncated[2] = (char) (truncated[2] | (DNS_FLAG_TC >> 8));
+    DNSCacheTest::store(cache, "tc.com/16", 2000, truncated);
+    CHECK(DNSCacheTest::find(cache, "tc.com/16", 2000, query).empty());
+    DNSCacheTest::store(cache, "fail.com/16", 2000, makeResponse(query, DNS_RCODE_SERVFAIL, records, 2, false));
+    CHECK(DNSCacheTest::find(cache, "fail.com/16", 2000, query).empty());
+
+    // a full cache drops the responses that expire first
+    DNSCache full(2, 600);
+    DNSCacheTest::store(full, "a.com/16", 1000, makeResponse(query, 0, { { DNS_TYPE_TXT, 50, "\x01a" } }, 1, false));
+    DNSCacheTest::store(full, "b.com/16", 1000, makeResponse(query, 0, { { DNS_TYPE_TXT, 20, "\x01b" } }, 1, false));
+    DNSCacheTest::store(full, "c.com/16", 1010, makeResponse(query, 0, { { DNS_TYPE_TXT, 30, "\x01c" } }, 1, false));
+    CHECK(!DNSCacheTest::find(full, "a.com/16", 1010, query).empty());
+    CHECK(DNSCacheTest::find(full, "b.com/16", 1010, query).empty());
+    CHECK(!DNSCacheTest::find(full, "c.com/16", 1010, query).empty());
+    DNSCacheTest::store(full, "d.com/16", 1045, makeResponse(query, 0, { { DNS_TYPE_TXT, 30, "\x01d" } }, 1, false));
+    CHECK(!DNSCacheTest::find(full, "a.com/16", 1045, query).empty());
+    CHECK(!DNSCacheTest::find(full, "d.com/16", 1045, query).empty());
+
+    // a response stored again replaces the previous one
+    DNSCacheTest::store(full, "d.com/16", 1046, makeResponse(query, 0, { { DNS_TYPE_TXT, 5, "\x01d" } }, 1, false));
+    CHECK(!DNSCacheTest::find(full, "d.com/16", 1050, query).empty());
+    CHECK(DNSCacheTest::find(full, "d.com/16", 1051, query).empty());
+    CHECK(!DNSCacheTest::find(full, "a.com/16", 1049, query).empty());
+}
+
+
+struct Test
+{
+    const char *name;
+    void (*run)();
+};
+
+static const Test TESTS[] =
+{
+    { "globs", testGlobs },
+    { "keywords", testKeywords },
+    { "stats", testStats },
+    { "policies", testPolicies },
+    { "heuristics", testHeuristics },
+    { "queries", testQueries },
+    { "cache", testCache },
+};
+
+
+int main( int argc, char **argv )
+{
+    size_t count = 0;
+    for (size_t i = 0; i < sizeof(TESTS) / sizeof(TESTS[0]); ++i)
+    {
+        if (argc > 1 && strcmp(argv[1], TESTS[i].name) != 0) continue;
+        int previous = failures;
+        TESTS[i].run();
+        fprintf(stdout, "%-12s %s\n", TESTS[i].name, (failures == previous) ? "passed" : "FAILED");
+        ++count;
+    }
+    if (count == 0)
+    {
+        fprintf(stderr, "Usage: tests [ <name> ]\n");
+        return 1;
+    }
+    return (failures == 0) ? 0 : 1;
+}